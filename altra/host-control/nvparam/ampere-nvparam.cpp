@@ -0,0 +1,344 @@
+/*
+// Copyright 2021 Ampere Computing LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#include <libnvparam.h>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/signal_set.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <sdbusplus/asio/connection.hpp>
+#include <sdbusplus/asio/object_server.hpp>
+#include <sdbusplus/exception.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <vector>
+
+namespace ampere
+{
+
+namespace nvparam
+{
+
+constexpr auto busName = "xyz.openbmc_project.Ampere.Nvparam";
+constexpr auto objectPath = "/xyz/openbmc_project/ampere/nvparam";
+constexpr auto interfaceName = "xyz.openbmc_project.Ampere.Nvparam";
+
+/* Set/Clear calls arriving within this window share one flash write */
+constexpr auto flushDelay = std::chrono::milliseconds(200);
+/* A failed flush is retried, doubling the delay up to this */
+constexpr auto maxRetryDelay = std::chrono::milliseconds(60000);
+/* Clean blocks older than this are re-read, to pick up nvparm changes */
+constexpr auto cacheLifetime = std::chrono::seconds(1);
+
+/** @brief The NVPARAM device, open for the lifetime of this object.
+ *  nvparam_open() locks it, so nvparm waits meanwhile and vice versa.
+ */
+class OpenDevice
+{
+  public:
+    OpenDevice()
+    {
+        int ret = nvparam_open(&dev);
+        if (ret < 0)
+        {
+            throw sdbusplus::exception::SdBusError(
+                -ret, "Unable to open NVPARAM device");
+        }
+    }
+
+    ~OpenDevice()
+    {
+        nvparam_close(&dev);
+    }
+
+    OpenDevice(const OpenDevice&) = delete;
+    OpenDevice& operator=(const OpenDevice&) = delete;
+
+    struct nvparam_dev dev = {};
+};
+
+/** @brief Erase blocks of the host SPI NOR cached in memory. Reads are
+ *  served from the cache, writes update the cache and are flushed to
+ *  flash in batches, one erase/program cycle per dirty block. The device
+ *  is only opened, and locked, while it is accessed; a flush re-reads each
+ *  dirty block and applies just the entries set or cleared here, so
+ *  concurrent nvparm updates are kept. The errno of the last failed flush
+ *  is published in the FlushError property.
+ */
+class NvparamCache
+{
+  public:
+    NvparamCache(boost::asio::io_context& io,
+                 std::shared_ptr<sdbusplus::asio::dbus_interface> iface) :
+        iface(std::move(iface)),
+        flushTimer(io)
+    {
+        int ret = nvparam_open(&layout);
+        if (ret < 0)
+        {
+            std::cerr << "Unable to open HOST SPI / PNOR MTD partition: "
+                      << std::strerror(-ret) << std::endl;
+            throw std::runtime_error("nvparam_open failed");
+        }
+        std::cout << "NVPARAM device: " << layout.flash.path << std::endl;
+        /* Only the geometry is kept, the device is reopened on demand */
+        nvparam_close(&layout);
+    }
+
+    NvparamCache(const NvparamCache&) = delete;
+    NvparamCache& operator=(const NvparamCache&) = delete;
+
+    uint32_t get(uint32_t offset)
+    {
+        auto& e = entry(offset);
+        if (!e.valid || !nvparam_entry_crc_ok(&e))
+        {
+            throw sdbusplus::exception::SdBusError(ENODATA,
+                                                   "NVPARAM entry not valid");
+        }
+        return e.param1;
+    }
+
+    void set(uint32_t offset, uint32_t value)
+    {
+        nvparam_entry_set(&entry(offset), value);
+        markDirty(offset);
+    }
+
+    void clear(uint32_t offset)
+    {
+        nvparam_entry_clear(&entry(offset));
+        markDirty(offset);
+    }
+
+    /** @brief Write every dirty block to flash. On failure the blocks
+     *  left stay dirty and a retry is scheduled with backoff.
+     */
+    void flush()
+    {
+        flushTimer.cancel();
+        flushPending = false;
+        if (dirty.empty())
+        {
+            return;
+        }
+        try
+        {
+            OpenDevice device;
+            for (auto it = dirty.begin(); it != dirty.end();)
+            {
+                commit(device.dev, it->first, it->second);
+                it = dirty.erase(it);
+            }
+        }
+        catch (const sdbusplus::exception::SdBusError& e)
+        {
+            std::cerr << e.what() << ", retrying in " << retryDelay.count()
+                      << "ms" << std::endl;
+            iface->set_property("FlushError",
+                                static_cast<int32_t>(e.get_errno()));
+            scheduleFlush(retryDelay);
+            retryDelay = std::min(retryDelay * 2, maxRetryDelay);
+            throw;
+        }
+        retryDelay = flushDelay;
+        iface->set_property("FlushError", static_cast<int32_t>(0));
+    }
+
+    /** @brief Drop clean blocks so they are re-read from flash */
+    void reload()
+    {
+        std::erase_if(blocks, [this](const auto& item) {
+            return !dirty.contains(item.first);
+        });
+    }
+
+  private:
+    struct Block
+    {
+        std::vector<uint8_t> data;
+        std::chrono::steady_clock::time_point loaded;
+    };
+
+    unsigned long blockBase(uint32_t offset) const
+    {
+        return (offset / layout.flash.mtd.erasesize) *
+               layout.flash.mtd.erasesize;
+    }
+
+    struct nvparam_entry& entry(uint32_t offset)
+    {
+        unsigned long base = 0;
+
+        if ((offset % sizeof(struct nvparam_entry)) ||
+            nvparam_block_base(&layout, offset, &base) < 0)
+        {
+            throw sdbusplus::exception::SdBusError(EINVAL,
+                                                   "Invalid NVPARAM offset");
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        auto it = blocks.find(base);
+        if (it == blocks.end() ||
+            (!dirty.contains(base) && now - it->second.loaded > cacheLifetime))
+        {
+            OpenDevice device;
+            std::vector<uint8_t> buf(layout.flash.mtd.erasesize);
+            int ret = nvparam_read_block(&device.dev, base, buf.data());
+            if (ret < 0)
+            {
+                throw sdbusplus::exception::SdBusError(
+                    -ret, "Failed to read NVPARAM");
+            }
+            it = blocks.insert_or_assign(base, Block{std::move(buf), now})
+                     .first;
+        }
+
+        return *reinterpret_cast<struct nvparam_entry*>(
+            it->second.data.data() + (offset - base));
+    }
+
+    /** @brief Write back a dirty block over its current flash contents,
+     *  replacing only the entries in offsets
+     */
+    void commit(struct nvparam_dev& dev, unsigned long base,
+                const std::set<uint32_t>& offsets)
+    {
+        auto& cached = blocks.at(base);
+        std::vector<uint8_t> buf(layout.flash.mtd.erasesize);
+
+        int ret = nvparam_read_block(&dev, base, buf.data());
+        if (ret >= 0)
+        {
+            for (auto offset : offsets)
+            {
+                std::memcpy(buf.data() + (offset - base),
+                            cached.data.data() + (offset - base),
+                            sizeof(struct nvparam_entry));
+            }
+            ret = nvparam_commit_block(&dev, base, buf.data());
+        }
+        if (ret < 0)
+        {
+            std::cerr << "Failed to write NVPARAM block 0x" << std::hex
+                      << base << std::dec << ": " << std::strerror(-ret)
+                      << std::endl;
+            throw sdbusplus::exception::SdBusError(-ret,
+                                                   "NVPARAM flush failed");
+        }
+        cached = Block{std::move(buf), std::chrono::steady_clock::now()};
+    }
+
+    void markDirty(uint32_t offset)
+    {
+        dirty[blockBase(offset)].insert(offset);
+        if (!flushPending)
+        {
+            scheduleFlush(flushDelay);
+        }
+    }
+
+    void scheduleFlush(std::chrono::milliseconds delay)
+    {
+        flushPending = true;
+        flushTimer.expires_after(delay);
+        flushTimer.async_wait([this](const boost::system::error_code& ec) {
+            if (ec)
+            {
+                return;
+            }
+            try
+            {
+                flush();
+            }
+            catch (const sdbusplus::exception::SdBusError&)
+            {
+                /* flush() has logged the error and re-armed the timer */
+            }
+        });
+    }
+
+    std::shared_ptr<sdbusplus::asio::dbus_interface> iface;
+    /* Device geometry from the first open, the device itself is closed */
+    struct nvparam_dev layout = {};
+    std::map<unsigned long, Block> blocks;
+    /* Dirty block base -> offsets of the entries set or cleared in it */
+    std::map<unsigned long, std::set<uint32_t>> dirty;
+    boost::asio::steady_timer flushTimer;
+    bool flushPending = false;
+    std::chrono::milliseconds retryDelay = flushDelay;
+};
+
+} // namespace nvparam
+} // namespace ampere
+
+int main()
+{
+    boost::asio::io_context io;
+    auto conn = std::make_shared<sdbusplus::asio::connection>(io);
+    conn->request_name(ampere::nvparam::busName);
+
+    sdbusplus::asio::object_server server(conn);
+    auto iface = server.add_interface(ampere::nvparam::objectPath,
+                                      ampere::nvparam::interfaceName);
+
+    std::unique_ptr<ampere::nvparam::NvparamCache> cache;
+    try
+    {
+        cache = std::make_unique<ampere::nvparam::NvparamCache>(io, iface);
+    }
+    catch (const std::runtime_error&)
+    {
+        /* The cause has been printed already */
+        return 1;
+    }
+
+    iface->register_method("Get", [&cache](uint32_t offset) {
+        return cache->get(offset);
+    });
+    iface->register_method("Set", [&cache](uint32_t offset, uint32_t value) {
+        cache->set(offset, value);
+    });
+    iface->register_method(
+        "Clear", [&cache](uint32_t offset) { cache->clear(offset); });
+    iface->register_method("Flush", [&cache]() { cache->flush(); });
+    iface->register_method("Reload", [&cache]() { cache->reload(); });
+    iface->register_property("FlushError", static_cast<int32_t>(0));
+    iface->initialize();
+
+    // Pending writes must reach flash before the service goes away
+    boost::asio::signal_set signals(io, SIGINT, SIGTERM);
+    signals.async_wait([&](const boost::system::error_code&, int) {
+        try
+        {
+            cache->flush();
+        }
+        catch (const sdbusplus::exception::SdBusError&)
+        {
+        }
+        io.stop();
+    });
+
+    io.run();
+    return 0;
+}
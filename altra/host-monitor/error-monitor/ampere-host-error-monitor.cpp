@@ -27,6 +27,8 @@
 #include <sdbusplus/asio/sd_event.hpp>
 #include <sdbusplus/asio/connection.hpp>
 
+#include <bitset>
+#include <chrono>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
@@ -118,9 +120,14 @@ const static constexpr u_int16_t NUMBER_DIMM_CHANNEL    = 8;
 
 const static constexpr char* AMPERE_REFISH_REGISTRY = "AmpereCritical";
 
-const static constexpr char* createFlagCmd = "touch /tmp/fault_RAS_UE";
-const static constexpr char* rmFlagCmd = "rm /tmp/fault_RAS_UE";
 const static constexpr char* RASUEFlagPath = "/tmp/fault_RAS_UE";
+const static constexpr char* HOST_STATE_PATH = "/xyz/openbmc_project/state/host";
+const static constexpr char* HOST_STATE_SERVICE = "xyz.openbmc_project.State.Host";
+/* A failed startup host state query is retried this often */
+const static constexpr auto HOST_STATE_RETRY = std::chrono::seconds(5);
+const static constexpr char* HOST_STATE_RUNNING =
+        "xyz.openbmc_project.State.Host.HostState.Running";
+const static constexpr u_int8_t MAX_SOCKET = 2;
 
 const static constexpr int ERR_RECORD_BYTE_BLOCK = 8;
 const static constexpr int BYTE_LEN = sizeof(u_int8_t) * 2;
@@ -231,6 +238,28 @@ ErrorData errorTypeTable[] = {
 const static constexpr u_int8_t NUMBER_OF_ERRORS    =
         sizeof(errorTypeTable) / sizeof(ErrorData);
 
+/*
+ * Event filter rules from the "event_filters" array of config.json, for
+ * example dropping PCIe AER Device CEs of socket 1:
+ *
+ *   {"source": "error_pcie_ce", "socket": 1, "err_type": 7, "sub_type": 1,
+ *    "action": "drop"}
+ *
+ * "source" is a label of errorTypeTable or eventTypeTable. "socket",
+ * "err_type" and "sub_type" (errors) or "bits" (events, a mask of event
+ * bits) default to all. "action" is "drop", "keep" or "remap" with a
+ * "severity" of "Critical" or "Warning". Later rules override earlier
+ * ones. The rules are compiled at startup into the bitmaps below, indexed
+ * by (errType << 8) | subType, so filtering costs a bit test per record.
+ * Errors are Critical and events Warning unless remapped.
+ */
+struct ErrorFilter {
+    std::bitset<0x10000> drop;
+    std::bitset<0x10000> warning;
+};
+
+std::unique_ptr<ErrorFilter> errorFilters[NUMBER_OF_ERRORS];
+
 struct ErrorInfo {
     u_int8_t errType;
     u_int8_t subType;
@@ -365,11 +394,67 @@ EventData eventTypeTable[] = {
 
 const static constexpr u_int8_t NUMBER_OF_EVENTS    =
         sizeof(eventTypeTable) / sizeof(EventData);
-u_int16_t curEventMask[NUMBER_OF_EVENTS] = {};
 
-std::unique_ptr<phosphor::Timer> rasTimer
+/*
+ * A monitored host. Without a "hosts" array in config.json there is one
+ * host using the s0/s1_errmon_path settings and following any host state
+ * object. Otherwise each entry, such as
+ *
+ *   {"id": 1, "s0_errmon_path": "...", "s1_errmon_path": "..."}
+ *
+ * is a host following /xyz/openbmc_project/state/host<id>, polled by its
+ * own timer with its own event state, all in the one event loop.
+ */
+struct Host {
+    u_int8_t id;
+    /* Host state object, empty to follow any host */
+    std::string statePath;
+    /* Bus name owning the host state object */
+    std::string stateService;
+    std::string rootDir[MAX_SOCKET];
+    std::string ueFlagPath;
+    /*
+     * Host attribution of the logs, set with a "hosts" array only: the SEL
+     * message and OEM data byte 9 (0xFF for a single host), a "Host<id> "
+     * prefix of string Redfish message arguments and a HOST_ID journal
+     * field.
+     */
+    std::string selMessage;
+    u_int8_t selId;
+    std::string redfishTag;
+    std::string hostIdEntry;
+    /*
+     * Last field of a journal entry: HOST_ID=<id>, or NULL for a single
+     * host, which ends the sd_journal_send() list one field early.
+     */
+    const char* hostIdField() const
+    {
+        return hostIdEntry.empty() ? nullptr : hostIdEntry.c_str();
+    }
+    std::unique_ptr<phosphor::Timer> timer;
+    /* Retries the startup host state query until it gets an answer */
+    std::unique_ptr<phosphor::Timer> stateRetry;
+    bool stateQueryFailed = false;
+    u_int16_t eventMask[NUMBER_OF_EVENTS] = {};
+    bool running = false;
+    /* A state change was signalled, newer than the startup query */
+    bool signalled = false;
+    bool polled = false;
+};
+
+/* Service start, for the time to first poll of each host */
+const auto startTime = std::chrono::steady_clock::now();
+
+std::vector<std::unique_ptr<Host>> hosts
     __attribute__((init_priority(101)));
 
+/* The host being polled and its event masks */
+Host* curHost = nullptr;
+u_int16_t* curEventMask = nullptr;
+/* Compiled event filter rules, one bit per event bit */
+u_int16_t eventDropMask[NUMBER_OF_EVENTS] = {};
+u_int16_t eventCriticalMask[NUMBER_OF_EVENTS] = {};
+
 std::unique_ptr<sdbusplus::bus::match::match> hostStateMatch;
 
 static int logInternalErrorToIpmiSEL(ErrorData data,
@@ -393,7 +478,7 @@ static int logInternalErrorToIpmiSEL(ErrorData data,
     eventData[10] = eFields.data & 0xff;
     eventData[11] = (eFields.data & 0xff00) >> 8;
 
-    ampere::sel::addSelOem("OEM RAS error:", eventData);
+    ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
 
     return 1;
 }
@@ -460,8 +545,9 @@ static int logInternalErrorToRedfish(ErrorData data,
             data.intErrorType == warn_pmpro)
     {
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redfishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s,%s", redfishComp,
-                        redfishMsg, NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                        curHost->redfishTag.c_str(), redfishComp,
+                        redfishMsg, curHost->hostIdField(), NULL);
     }
 
     return 1;
@@ -590,7 +676,8 @@ static int parseAndLogInternalErrors(ErrorData data, std::string errLine)
     return 1;
 }
 
-static int logErrorToRedfish(ErrorData data, ErrorFields eFields)
+static int logErrorToRedfish(ErrorData data, ErrorFields eFields,
+                             const char* severity)
 {
     char redFishMsgID[MAX_MSG_LEN] = {'\0'};
     char redFishMsg[MAX_MSG_LEN] = {'\0'};
@@ -602,7 +689,7 @@ static int logErrorToRedfish(ErrorData data, ErrorFields eFields)
     ErrorInfo eInfo;
 
     snprintf(redFishMsgID, MAX_MSG_LEN,
-             "OpenBMC.0.1.%s.Critical", data.redFishMsgID);
+             "OpenBMC.0.1.%s.%s", data.redFishMsgID, severity);
     temp = (eFields.errType << 8) + eFields.subType;
     if (mapOfOccur.size() != 0 && mapOfOccur.count(temp) > 0)
     {
@@ -628,11 +715,12 @@ static int logErrorToRedfish(ErrorData data, ErrorFields eFields)
     {
         char comp[MAX_MSG_LEN] = {'\0'};
         snprintf(redFishMsgID, MAX_MSG_LEN,
-                "OpenBMC.0.1.%s.Critical", AMPERE_REFISH_REGISTRY);
+                "OpenBMC.0.1.%s.%s", AMPERE_REFISH_REGISTRY, severity);
         snprintf(comp, MAX_MSG_LEN, "%s: %s", data.errName, redFishComp);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                        NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                        curHost->redfishTag.c_str(), comp, redFishMsg,
+                        curHost->hostIdField(), NULL);
         return 1;
     }
 
@@ -642,7 +730,9 @@ static int logErrorToRedfish(ErrorData data, ErrorFields eFields)
         snprintf(sTemp, MAX_MSG_LEN, "%s: %s %s", data.errName,
                  redFishComp, redFishMsg);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s", sTemp, NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s",
+                        curHost->redfishTag.c_str(), sTemp,
+                        curHost->hostIdField(), NULL);
     }
     else if (apiIdx == error_mem_ue || apiIdx == error_mem_ce)
     {
@@ -660,13 +750,13 @@ static int logErrorToRedfish(ErrorData data, ErrorFields eFields)
             sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
                             "REDFISH_MESSAGE_ARGS=%d,%s,%d,%d", socket,
                             dimCh, (inst_13_0 & 0x3800) >> 11,
-                            rank , NULL);
+                            rank , curHost->hostIdField(), NULL);
         }
         else
         {
             sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
                             "REDFISH_MESSAGE_ARGS=%d,%s,%d,%d", socket,
-                            dimCh, 0xff, 0xff, NULL);
+                            dimCh, 0xff, 0xff, curHost->hostIdField(), NULL);
         }
         if (apiIdx == error_mem_ue)
         {
@@ -680,26 +770,28 @@ static int logErrorToRedfish(ErrorData data, ErrorFields eFields)
         }
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishECCMsgID,
                         "REDFISH_MESSAGE_ARGS=%d,%d,%d", bank,
-                        row, col, NULL);
+                        row, col, curHost->hostIdField(), NULL);
     }
     else if (apiIdx == error_pcie_ue || apiIdx == error_pcie_ce)
     {
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
                         "REDFISH_MESSAGE_ARGS=%d,%d,%d", socket,
-                        inst_13_0, 0, NULL);
+                        inst_13_0, 0, curHost->hostIdField(), NULL);
     }
     else if (apiIdx == error_other_ue || apiIdx == error_other_ce)
     {
         char comp[MAX_MSG_LEN] = {'\0'};
         snprintf(comp, MAX_MSG_LEN, "%s: %s", data.errName, redFishComp);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                        NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                        curHost->redfishTag.c_str(), comp, redFishMsg,
+                        curHost->hostIdField(), NULL);
     }
     if (apiIdx == error_core_ue || apiIdx == error_mem_ue ||
             apiIdx == error_pcie_ue || apiIdx == error_other_ue)
     {
-        if(std::system(createFlagCmd) != 0)
+        std::string cmd = "touch " + curHost->ueFlagPath;
+        if(std::system(cmd.c_str()) != 0)
             log<level::INFO>("Cannot create flag RAS UE for fault monitor");
     }
     return 1;
@@ -715,12 +807,13 @@ static int logErrorToIpmiSEL(ErrorData data, ErrorFields eFields)
     eventData[2] = AMPERE_IANA_BYTE_3;
     eventData[3] = data.errType;
     eventData[4] = data.errNum;
+    eventData[9] = curHost->selId;
     eventData[5] = eFields.errType;
     eventData[6] = eFields.subType;
     eventData[7] = (eFields.instance & 0xff00) >> 8;
     eventData[8] = (eFields.instance & 0xff);
 
-    ampere::sel::addSelOem("OEM RAS error:", eventData);
+    ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
 
     return 1;
 }
@@ -766,13 +859,32 @@ static int prepareErrData(const std::string& errLine,
     return 0;
 }
 
-static int parseAndLogErrors(ErrorData data, std::string errLine)
+static int parseAndLogErrors(ErrorData data, std::string errLine,
+                             const ErrorFilter* filter)
 {
     ErrorFields errFields;
     std::vector<std::string> result;
+    const char* severity = "Critical";
+    u_int16_t key;
 
     errLine.erase(std::remove(errLine.begin(), errLine.end(), '\n'),
                   errLine.end());
+    /* Filter on the error type and subtype before parsing the record */
+    if (filter && errLine.size() >= BYTE_LEN * 2)
+    {
+        key = (ampere::utils::parseHexStrToUInt8(
+                   errLine.substr(0, BYTE_LEN)) << 8) |
+              ampere::utils::parseHexStrToUInt8(
+                   errLine.substr(BYTE_LEN, BYTE_LEN));
+        if (filter->drop.test(key))
+        {
+            return 0;
+        }
+        if (filter->warning.test(key))
+        {
+            severity = "Warning";
+        }
+    }
     prepareErrData(errLine, result);
     if (result.size() < 5)
     {
@@ -803,12 +915,13 @@ static int parseAndLogErrors(ErrorData data, std::string errLine)
     logErrorToIpmiSEL(data, errFields);
 
     /* Add Redfish log */
-    logErrorToRedfish(data, errFields);
+    logErrorToRedfish(data, errFields, severity);
 
     return 1;
 }
 
-static int logErrors(ErrorData data, const char *fileName) {
+static int logErrors(ErrorData data, const char *fileName,
+                     const ErrorFilter* filter) {
     FILE *fp;
     char* line = NULL;
 
@@ -831,7 +944,7 @@ static int logErrors(ErrorData data, const char *fileName) {
         }
         else
         {
-            parseAndLogErrors(data, line);
+            parseAndLogErrors(data, line, filter);
         }
     }
 
@@ -844,7 +957,8 @@ static int logErrors(ErrorData data, const char *fileName) {
     return 1;
 }
 
-static int logEventDIMMHot(EventData data, EventFields eFields)
+static int logEventDIMMHot(EventData data, EventFields eFields,
+                           const char* severity)
 {
     std::vector<uint8_t> eventData(
             ampere::sel::SEL_OEM_DATA_MAX_SIZE, 0xFF);
@@ -861,10 +975,11 @@ static int logEventDIMMHot(EventData data, EventFields eFields)
     eventData[2] = AMPERE_IANA_BYTE_3;
     eventData[3] = data.eventType;
     eventData[4] = data.eventNum;
+    eventData[9] = curHost->selId;
     eventData[6] = 0x1 | EVENT_DATA_1 | EVENT_DATA_3;
 
     snprintf(redFishMsgID, MAX_MSG_LEN,
-             "OpenBMC.0.1.%s.Warning", data.redFishMsgID);
+             "OpenBMC.0.1.%s.%s", data.redFishMsgID, severity);
     for (i = 0; i < SMPRO_DATA_REG_SIZE; i++)
     {
         bitMask = pow(2, i);
@@ -888,12 +1003,13 @@ static int logEventDIMMHot(EventData data, EventFields eFields)
                 eventData[8] = bitMask;
             }
             curEventMask[data.idx] = curEventMask[data.idx] | bitMask;
-            ampere::sel::addSelOem("OEM RAS error:", eventData);
+            ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
 
             snprintf(redFishMsg, MAX_MSG_LEN, "Asserted.");
             sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                            "REDFISH_MESSAGE_ARGS=%s,%s", comp,
-                            redFishMsg, NULL);
+                            "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                            curHost->redfishTag.c_str(), comp,
+                            redFishMsg, curHost->hostIdField(), NULL);
 
         }
         else if ((!(eFields.data & bitMask)) && (currentMask & bitMask))
@@ -911,19 +1027,21 @@ static int logEventDIMMHot(EventData data, EventFields eFields)
             }
             curEventMask[data.idx] = curEventMask[data.idx] &
                                      (0xffff - bitMask);
-            ampere::sel::addSelOem("OEM RAS error:", eventData);
+            ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
 
             snprintf(redFishMsg, MAX_MSG_LEN, "Deasserted.");
             sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                            "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                            NULL);
+                            "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                            curHost->redfishTag.c_str(), comp, redFishMsg,
+                            curHost->hostIdField(), NULL);
         }
     }
 
     return 1;
 }
 
-static int logEventDIMM2xRefresh(EventData data, EventFields eFields)
+static int logEventDIMM2xRefresh(EventData data, EventFields eFields,
+                                 const char* severity)
 {
     std::vector<uint8_t> eventData(
             ampere::sel::SEL_OEM_DATA_MAX_SIZE, 0xFF);
@@ -939,10 +1057,11 @@ static int logEventDIMM2xRefresh(EventData data, EventFields eFields)
     eventData[2] = AMPERE_IANA_BYTE_3;
     eventData[3] = data.eventType;
     eventData[4] = data.eventNum;
+    eventData[9] = curHost->selId;
     eventData[6] = 0x1 | EVENT_DATA_1 | EVENT_DATA_3;
 
     snprintf(redFishMsgID, MAX_MSG_LEN,
-             "OpenBMC.0.1.%s.Warning", data.redFishMsgID);
+             "OpenBMC.0.1.%s.%s", data.redFishMsgID, severity);
     for (channel = 0; channel < NUMBER_DIMM_CHANNEL; channel++)
     {
         bitMask = pow(2, channel);
@@ -958,10 +1077,11 @@ static int logEventDIMM2xRefresh(EventData data, EventFields eFields)
             curEventMask[data.idx] = curEventMask[data.idx] | bitMask;
 
             snprintf(redFishMsg, MAX_MSG_LEN, "Asserted.");
-            ampere::sel::addSelOem("OEM RAS error:", eventData);
+            ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
             sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                            "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                            NULL);
+                            "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                            curHost->redfishTag.c_str(), comp, redFishMsg,
+                            curHost->hostIdField(), NULL);
         }
         else if ((!(eFields.data & bitMask)) && (currentMask & bitMask))
         {
@@ -969,17 +1089,19 @@ static int logEventDIMM2xRefresh(EventData data, EventFields eFields)
             curEventMask[data.idx] = curEventMask[data.idx] &
                                      (0xffff - bitMask);
             snprintf(redFishMsg, MAX_MSG_LEN, "Deasserted.");
-            ampere::sel::addSelOem("OEM RAS error:", eventData);
+            ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
             sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                            "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                            NULL);
+                            "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                            curHost->redfishTag.c_str(), comp, redFishMsg,
+                            curHost->hostIdField(), NULL);
         }
     }
 
     return 1;
 }
 
-static int logEventVrdHot(EventData data, EventFields eFields)
+static int logEventVrdHot(EventData data, EventFields eFields,
+                          const char* severity)
 {
     std::vector<uint8_t> eventData(
             ampere::sel::SEL_OEM_DATA_MAX_SIZE, 0xFF);
@@ -993,10 +1115,11 @@ static int logEventVrdHot(EventData data, EventFields eFields)
     eventData[2] = AMPERE_IANA_BYTE_3;
     eventData[3] = data.eventType;
     eventData[4] = data.eventNum;
+    eventData[9] = curHost->selId;
     eventData[6] = 0x1 | EVENT_DATA_1 | EVENT_DATA_3;
 
     snprintf(redFishMsgID, MAX_MSG_LEN,
-             "OpenBMC.0.1.%s.Warning", data.redFishMsgID);
+             "OpenBMC.0.1.%s.%s", data.redFishMsgID, severity);
     /* SoC VRD hot */
     if ((eFields.data & BIT_0) && (!(currentMask & BIT_0)))
     {
@@ -1004,14 +1127,15 @@ static int logEventVrdHot(EventData data, EventFields eFields)
         eventData[7] = (SOC_COMPONENT << 4) | data.socket;
         eventData[8] = 0;
         curEventMask[data.idx] = curEventMask[data.idx] | BIT_0;
-        ampere::sel::addSelOem("OEM RAS error:", eventData);
+        ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
 
         snprintf(redFishMsg, MAX_MSG_LEN, "Asserted.");
         snprintf(comp, MAX_MSG_LEN, "Event %s at SoC_VRD of Socket %d",
                  data.eventName, data.socket);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                        NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                        curHost->redfishTag.c_str(), comp, redFishMsg,
+                        curHost->hostIdField(), NULL);
     }
     else if ((!(eFields.data & BIT_0)) && (currentMask & BIT_0))
     {
@@ -1019,14 +1143,15 @@ static int logEventVrdHot(EventData data, EventFields eFields)
         eventData[7] = (SOC_COMPONENT << 4) | data.socket;
         eventData[8] = 0;
         curEventMask[data.idx] = curEventMask[data.idx] & (0xffff - BIT_0);
-        ampere::sel::addSelOem("OEM RAS error:", eventData);
+        ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
 
         snprintf(redFishMsg, MAX_MSG_LEN, "Deasserted.");
         snprintf(comp, MAX_MSG_LEN, "Event %s at SoC_VRD of Socket %d",
                  data.eventName, data.socket);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                        NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                        curHost->redfishTag.c_str(), comp, redFishMsg,
+                        curHost->hostIdField(), NULL);
     }
 
     /* Core VRD1 fault/warning */
@@ -1036,14 +1161,15 @@ static int logEventVrdHot(EventData data, EventFields eFields)
         eventData[7] = (CORE_COMPONENT << 4) | data.socket;
         eventData[8] = VRD_1;
         curEventMask[data.idx] = curEventMask[data.idx] | BIT_4;
-        ampere::sel::addSelOem("OEM RAS error:", eventData);
+        ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
 
         snprintf(redFishMsg, MAX_MSG_LEN, "Asserted.");
         snprintf(comp, MAX_MSG_LEN, "Event %s at CORE_VRD%d of Socket %d",
                  data.eventName, VRD_1, data.socket);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                        NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                        curHost->redfishTag.c_str(), comp, redFishMsg,
+                        curHost->hostIdField(), NULL);
     }
     else if ((!(eFields.data & BIT_4)) && (currentMask & BIT_4))
     {
@@ -1051,14 +1177,15 @@ static int logEventVrdHot(EventData data, EventFields eFields)
         eventData[7] = (CORE_COMPONENT << 4) | data.socket;
         eventData[8] = VRD_1;
         curEventMask[data.idx] = curEventMask[data.idx] & (0xffff - BIT_4);
-        ampere::sel::addSelOem("OEM RAS error:", eventData);
+        ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
 
         snprintf(redFishMsg, MAX_MSG_LEN, "Deasserted.");
         snprintf(comp, MAX_MSG_LEN, "Event %s at CORE_VRD%d of Socket %d",
                  data.eventName, VRD_1, data.socket);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                        NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                        curHost->redfishTag.c_str(), comp, redFishMsg,
+                        curHost->hostIdField(), NULL);
     }
 
     /* Core VRD2 fault/warning */
@@ -1068,14 +1195,15 @@ static int logEventVrdHot(EventData data, EventFields eFields)
         eventData[7] = (CORE_COMPONENT << 4) | data.socket;
         eventData[8] = VRD_2;
         curEventMask[data.idx] = curEventMask[data.idx] | BIT_5;
-        ampere::sel::addSelOem("OEM RAS error:", eventData);
+        ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
 
         snprintf(redFishMsg, MAX_MSG_LEN, "Asserted.");
         snprintf(comp, MAX_MSG_LEN, "Event %s at CORE_VRD%d of Socket %d",
                  data.eventName, VRD_2, data.socket);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                        NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                        curHost->redfishTag.c_str(), comp, redFishMsg,
+                        curHost->hostIdField(), NULL);
     }
     else if ((!(eFields.data & BIT_5)) && (currentMask & BIT_5))
     {
@@ -1083,14 +1211,15 @@ static int logEventVrdHot(EventData data, EventFields eFields)
         eventData[7] = (CORE_COMPONENT << 4) | data.socket;
         eventData[8] = VRD_2;
         curEventMask[data.idx] = curEventMask[data.idx] & (0xffff - BIT_5);
-        ampere::sel::addSelOem("OEM RAS error:", eventData);
+        ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
 
         snprintf(redFishMsg, MAX_MSG_LEN, "Deasserted.");
         snprintf(comp, MAX_MSG_LEN, "Event %s at CORE_VRD%d of Socket %d",
                  data.eventName, VRD_2, data.socket);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                        NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                        curHost->redfishTag.c_str(), comp, redFishMsg,
+                        curHost->hostIdField(), NULL);
     }
 
     /* Core VRD3 fault/warning */
@@ -1100,14 +1229,15 @@ static int logEventVrdHot(EventData data, EventFields eFields)
         eventData[7] = (CORE_COMPONENT << 4) | data.socket;
         eventData[8] = VRD_3;
         curEventMask[data.idx] = curEventMask[data.idx] | BIT_6;
-        ampere::sel::addSelOem("OEM RAS error:", eventData);
+        ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
 
         snprintf(redFishMsg, MAX_MSG_LEN, "Asserted.");
         snprintf(comp, MAX_MSG_LEN, "Event %s at CORE_VRD%d of Socket %d",
                  data.eventName, VRD_3, data.socket);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                        NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                        curHost->redfishTag.c_str(), comp, redFishMsg,
+                        curHost->hostIdField(), NULL);
     }
     else if ((!(eFields.data & BIT_6)) && (currentMask & BIT_6))
     {
@@ -1115,14 +1245,15 @@ static int logEventVrdHot(EventData data, EventFields eFields)
         eventData[7] = (CORE_COMPONENT << 4) | data.socket;
         eventData[8] = VRD_3;
         curEventMask[data.idx] = curEventMask[data.idx] & (0xffff - BIT_6);
-        ampere::sel::addSelOem("OEM RAS error:", eventData);
+        ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
 
         snprintf(redFishMsg, MAX_MSG_LEN, "Deasserted.");
         snprintf(comp, MAX_MSG_LEN, "Event %s at CORE_VRD%d of Socket %d",
                  data.eventName, VRD_3, data.socket);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                        NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                        curHost->redfishTag.c_str(), comp, redFishMsg,
+                        curHost->hostIdField(), NULL);
     }
 
     /* DIMM VRD1 fault/warning */
@@ -1132,14 +1263,15 @@ static int logEventVrdHot(EventData data, EventFields eFields)
         eventData[7] = (DIMM_COMPONENT << 4) | data.socket;
         eventData[8] = VRD_1;
         curEventMask[data.idx] = curEventMask[data.idx] | BIT_8;
-        ampere::sel::addSelOem("OEM RAS error:", eventData);
+        ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
 
         snprintf(redFishMsg, MAX_MSG_LEN, "Asserted.");
         snprintf(comp, MAX_MSG_LEN, "Event %s at DIMM_VRD%d of Socket %d",
                  data.eventName, VRD_1, data.socket);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                        NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                        curHost->redfishTag.c_str(), comp, redFishMsg,
+                        curHost->hostIdField(), NULL);
     }
     else if ((!(eFields.data & BIT_8)) && (currentMask & BIT_8))
     {
@@ -1147,14 +1279,15 @@ static int logEventVrdHot(EventData data, EventFields eFields)
         eventData[7] = (DIMM_COMPONENT << 4) | data.socket;
         eventData[8] = VRD_1;
         curEventMask[data.idx] = curEventMask[data.idx] & (0xffff - BIT_8);
-        ampere::sel::addSelOem("OEM RAS error:", eventData);
+        ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
 
         snprintf(redFishMsg, MAX_MSG_LEN, "Deasserted.");
         snprintf(comp, MAX_MSG_LEN, "Event %s at DIMM_VRD%d of Socket %d",
                  data.eventName, VRD_1, data.socket);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                        NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                        curHost->redfishTag.c_str(), comp, redFishMsg,
+                        curHost->hostIdField(), NULL);
     }
 
     /* DIMM VRD2 fault/warning */
@@ -1164,14 +1297,15 @@ static int logEventVrdHot(EventData data, EventFields eFields)
         eventData[7] = (DIMM_COMPONENT << 4) | data.socket;
         eventData[8] = VRD_2;
         curEventMask[data.idx] = curEventMask[data.idx] | BIT_9;
-        ampere::sel::addSelOem("OEM RAS error:", eventData);
+        ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
 
         snprintf(redFishMsg, MAX_MSG_LEN, "Asserted.");
         snprintf(comp, MAX_MSG_LEN, "Event %s at DIMM_VRD%d of Socket %d",
                  data.eventName, VRD_2, data.socket);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                        NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                        curHost->redfishTag.c_str(), comp, redFishMsg,
+                        curHost->hostIdField(), NULL);
     }
     else if ((!(eFields.data & BIT_9)) && (currentMask & BIT_9))
     {
@@ -1179,14 +1313,15 @@ static int logEventVrdHot(EventData data, EventFields eFields)
         eventData[7] = (DIMM_COMPONENT << 4) | data.socket;
         eventData[8] = VRD_2;
         curEventMask[data.idx] = curEventMask[data.idx] & (0xffff - BIT_9);
-        ampere::sel::addSelOem("OEM RAS error:", eventData);
+        ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
 
         snprintf(redFishMsg, MAX_MSG_LEN, "Deasserted.");
         snprintf(comp, MAX_MSG_LEN, "Event %s at DIMM_VRD%d of Socket %d",
                  data.eventName, VRD_2, data.socket);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                        NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                        curHost->redfishTag.c_str(), comp, redFishMsg,
+                        curHost->hostIdField(), NULL);
     }
 
     /* DIMM VRD3 fault/warning */
@@ -1196,14 +1331,15 @@ static int logEventVrdHot(EventData data, EventFields eFields)
         eventData[7] = (DIMM_COMPONENT << 4) | data.socket;
         eventData[8] = VRD_3;
         curEventMask[data.idx] = curEventMask[data.idx] | BIT_10;
-        ampere::sel::addSelOem("OEM RAS error:", eventData);
+        ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
 
         snprintf(redFishMsg, MAX_MSG_LEN, "Asserted.");
         snprintf(comp, MAX_MSG_LEN, "Event %s at DIMM_VRD%d of Socket %d",
                  data.eventName, VRD_3, data.socket);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                        NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                        curHost->redfishTag.c_str(), comp, redFishMsg,
+                        curHost->hostIdField(), NULL);
     }
     else if ((!(eFields.data & BIT_10)) && (currentMask & BIT_10))
     {
@@ -1211,14 +1347,15 @@ static int logEventVrdHot(EventData data, EventFields eFields)
         eventData[7] = (DIMM_COMPONENT << 4) | data.socket;
         eventData[8] = VRD_3;
         curEventMask[data.idx] = curEventMask[data.idx] & (0xffff - BIT_10);
-        ampere::sel::addSelOem("OEM RAS error:", eventData);
+        ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
 
         snprintf(redFishMsg, MAX_MSG_LEN, "Deasserted.");
         snprintf(comp, MAX_MSG_LEN, "Event %s at DIMM_VRD%d of Socket %d",
                  data.eventName, VRD_3, data.socket);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                        NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                        curHost->redfishTag.c_str(), comp, redFishMsg,
+                        curHost->hostIdField(), NULL);
     }
 
     /* DIMM VRD4 fault/warning */
@@ -1228,14 +1365,15 @@ static int logEventVrdHot(EventData data, EventFields eFields)
         eventData[7] = (DIMM_COMPONENT << 4) | data.socket;
         eventData[8] = VRD_4;
         curEventMask[data.idx] = curEventMask[data.idx] | BIT_11;
-        ampere::sel::addSelOem("OEM RAS error:", eventData);
+        ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
 
         snprintf(redFishMsg, MAX_MSG_LEN, "Asserted.");
         snprintf(comp, MAX_MSG_LEN, "Event %s at DIMM_VRD%d of Socket %d",
                  data.eventName, VRD_4, data.socket);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                        NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                        curHost->redfishTag.c_str(), comp, redFishMsg,
+                        curHost->hostIdField(), NULL);
     }
     else if ((!(eFields.data & BIT_11)) && (currentMask & BIT_11))
     {
@@ -1243,20 +1381,22 @@ static int logEventVrdHot(EventData data, EventFields eFields)
         eventData[7] = (DIMM_COMPONENT << 4) | data.socket;
         eventData[8] = VRD_4;
         curEventMask[data.idx] = curEventMask[data.idx] & (0xffff - BIT_11);
-        ampere::sel::addSelOem("OEM RAS error:", eventData);
+        ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
 
         snprintf(redFishMsg, MAX_MSG_LEN, "Deasserted.");
         snprintf(comp, MAX_MSG_LEN, "Event %s at DIMM_VRD%d of Socket %d",
                  data.eventName, VRD_4, data.socket);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                        NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                        curHost->redfishTag.c_str(), comp, redFishMsg,
+                        curHost->hostIdField(), NULL);
     }
 
     return 1;
 }
 
-static int logEventVrdWarnFault(EventData data, EventFields eFields)
+static int logEventVrdWarnFault(EventData data, EventFields eFields,
+                                const char* severity)
 {
     std::vector<uint8_t> eventData(
             ampere::sel::SEL_OEM_DATA_MAX_SIZE, 0xFF);
@@ -1270,10 +1410,11 @@ static int logEventVrdWarnFault(EventData data, EventFields eFields)
     eventData[2] = AMPERE_IANA_BYTE_3;
     eventData[3] = data.eventType;
     eventData[4] = data.eventNum;
+    eventData[9] = curHost->selId;
     eventData[6] = 0x1 | EVENT_DATA_1 | EVENT_DATA_3;
 
     snprintf(redFishMsgID, MAX_MSG_LEN,
-             "OpenBMC.0.1.%s.Warning", data.redFishMsgID);
+             "OpenBMC.0.1.%s.%s", data.redFishMsgID, severity);
     /* SoC VRD fault/warning */
     if ((eFields.data & BIT_0) && (!(currentMask & BIT_0)))
     {
@@ -1281,13 +1422,14 @@ static int logEventVrdWarnFault(EventData data, EventFields eFields)
         eventData[7] = (SOC_COMPONENT << 4) | data.socket;
         eventData[8] = 0;
         curEventMask[data.idx] = curEventMask[data.idx] | BIT_0;
-        ampere::sel::addSelOem("OEM RAS error:", eventData);
+        ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
         snprintf(redFishMsg, MAX_MSG_LEN, "Asserted.");
         snprintf(comp, MAX_MSG_LEN, "Event %s at SoC_VRD of Socket %d",
                  data.eventName, data.socket);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                        NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                        curHost->redfishTag.c_str(), comp, redFishMsg,
+                        curHost->hostIdField(), NULL);
     }
     else if ((!(eFields.data & BIT_0)) && (currentMask & BIT_0))
     {
@@ -1295,13 +1437,14 @@ static int logEventVrdWarnFault(EventData data, EventFields eFields)
         eventData[7] = (SOC_COMPONENT << 4) | data.socket;
         eventData[8] = 0;
         curEventMask[data.idx] = curEventMask[data.idx] & (0xffff - BIT_0);
-        ampere::sel::addSelOem("OEM RAS error:", eventData);
+        ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
         snprintf(redFishMsg, MAX_MSG_LEN, "Deasserted.");
         snprintf(comp, MAX_MSG_LEN, "Event %s at SoC_VRD of Socket %d",
                  data.eventName, data.socket);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                        NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                        curHost->redfishTag.c_str(), comp, redFishMsg,
+                        curHost->hostIdField(), NULL);
     }
 
     /* Core VRD1 fault/warning */
@@ -1311,14 +1454,15 @@ static int logEventVrdWarnFault(EventData data, EventFields eFields)
         eventData[7] = (CORE_COMPONENT << 4) | data.socket;
         eventData[8] = VRD_1;
         curEventMask[data.idx] = curEventMask[data.idx] | BIT_1;
-        ampere::sel::addSelOem("OEM RAS error:", eventData);
+        ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
 
         snprintf(redFishMsg, MAX_MSG_LEN, "Asserted.");
         snprintf(comp, MAX_MSG_LEN, "Event %s at CORE_VRD%d of Socket %d",
                  data.eventName, VRD_1, data.socket);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                        NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                        curHost->redfishTag.c_str(), comp, redFishMsg,
+                        curHost->hostIdField(), NULL);
     }
     else if ((!(eFields.data & BIT_1)) && (currentMask & BIT_1))
     {
@@ -1326,14 +1470,15 @@ static int logEventVrdWarnFault(EventData data, EventFields eFields)
         eventData[7] = (CORE_COMPONENT << 4) | data.socket;
         eventData[8] = VRD_1;
         curEventMask[data.idx] = curEventMask[data.idx] & (0xffff - BIT_1);
-        ampere::sel::addSelOem("OEM RAS error:", eventData);
+        ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
 
         snprintf(redFishMsg, MAX_MSG_LEN, "Deasserted.");
         snprintf(comp, MAX_MSG_LEN, "Event %s at CORE_VRD%d of Socket %d",
                  data.eventName, VRD_1, data.socket);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                        NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                        curHost->redfishTag.c_str(), comp, redFishMsg,
+                        curHost->hostIdField(), NULL);
     }
 
     /* Core VRD2 fault/warning */
@@ -1343,14 +1488,15 @@ static int logEventVrdWarnFault(EventData data, EventFields eFields)
         eventData[7] = (CORE_COMPONENT << 4) | data.socket;
         eventData[8] = VRD_2;
         curEventMask[data.idx] = curEventMask[data.idx] | BIT_2;
-        ampere::sel::addSelOem("OEM RAS error:", eventData);
+        ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
 
         snprintf(redFishMsg, MAX_MSG_LEN, "Asserted.");
         snprintf(comp, MAX_MSG_LEN, "Event %s at CORE_VRD%d of Socket %d",
                  data.eventName, VRD_2, data.socket);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                        NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                        curHost->redfishTag.c_str(), comp, redFishMsg,
+                        curHost->hostIdField(), NULL);
     }
     else if ((!(eFields.data & BIT_2)) && (currentMask & BIT_2))
     {
@@ -1358,14 +1504,15 @@ static int logEventVrdWarnFault(EventData data, EventFields eFields)
         eventData[7] = (CORE_COMPONENT << 4) | data.socket;
         eventData[8] = VRD_2;
         curEventMask[data.idx] = curEventMask[data.idx] & (0xffff - BIT_2);
-        ampere::sel::addSelOem("OEM RAS error:", eventData);
+        ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
 
         snprintf(redFishMsg, MAX_MSG_LEN, "Deasserted.");
         snprintf(comp, MAX_MSG_LEN, "Event %s at CORE_VRD%d of Socket %d",
                  data.eventName, VRD_2, data.socket);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                        NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                        curHost->redfishTag.c_str(), comp, redFishMsg,
+                        curHost->hostIdField(), NULL);
     }
 
     /* Core VRD3 fault/warning */
@@ -1375,14 +1522,15 @@ static int logEventVrdWarnFault(EventData data, EventFields eFields)
         eventData[7] = (CORE_COMPONENT << 4) | data.socket;
         eventData[8] = VRD_3;
         curEventMask[data.idx] = curEventMask[data.idx] | BIT_3;
-        ampere::sel::addSelOem("OEM RAS error:", eventData);
+        ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
 
         snprintf(redFishMsg, MAX_MSG_LEN, "Asserted.");
         snprintf(comp, MAX_MSG_LEN, "Event %s at CORE_VRD%d of Socket %d",
                  data.eventName, VRD_3, data.socket);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                        NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                        curHost->redfishTag.c_str(), comp, redFishMsg,
+                        curHost->hostIdField(), NULL);
     }
     else if ((!(eFields.data & BIT_3)) && (currentMask & BIT_3))
     {
@@ -1390,14 +1538,15 @@ static int logEventVrdWarnFault(EventData data, EventFields eFields)
         eventData[7] = (CORE_COMPONENT << 4) | data.socket;
         eventData[8] = VRD_3;
         curEventMask[data.idx] = curEventMask[data.idx] & (0xffff - BIT_3);
-        ampere::sel::addSelOem("OEM RAS error:", eventData);
+        ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
 
         snprintf(redFishMsg, MAX_MSG_LEN, "Deasserted.");
         snprintf(comp, MAX_MSG_LEN, "Event %s at CORE_VRD%d of Socket %d",
                  data.eventName, VRD_3, data.socket);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                        NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                        curHost->redfishTag.c_str(), comp, redFishMsg,
+                        curHost->hostIdField(), NULL);
     }
 
     /* DIMM VRD1 fault/warning */
@@ -1407,14 +1556,15 @@ static int logEventVrdWarnFault(EventData data, EventFields eFields)
         eventData[7] = (DIMM_COMPONENT << 4) | data.socket;
         eventData[8] = VRD_1;
         curEventMask[data.idx] = curEventMask[data.idx] | BIT_4;
-        ampere::sel::addSelOem("OEM RAS error:", eventData);
+        ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
 
         snprintf(redFishMsg, MAX_MSG_LEN, "Asserted.");
         snprintf(comp, MAX_MSG_LEN, "Event %s at DIMM_VRD%d of Socket %d",
                  data.eventName, VRD_1, data.socket);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                        NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                        curHost->redfishTag.c_str(), comp, redFishMsg,
+                        curHost->hostIdField(), NULL);
     }
     else if ((!(eFields.data & BIT_4)) && (currentMask & BIT_4))
     {
@@ -1422,14 +1572,15 @@ static int logEventVrdWarnFault(EventData data, EventFields eFields)
         eventData[7] = (DIMM_COMPONENT << 4) | data.socket;
         eventData[8] = VRD_1;
         curEventMask[data.idx] = curEventMask[data.idx] & (0xffff - BIT_4);
-        ampere::sel::addSelOem("OEM RAS error:", eventData);
+        ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
 
         snprintf(redFishMsg, MAX_MSG_LEN, "Deasserted.");
         snprintf(comp, MAX_MSG_LEN, "Event %s at DIMM_VRD%d of Socket %d",
                  data.eventName, VRD_1, data.socket);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                        NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                        curHost->redfishTag.c_str(), comp, redFishMsg,
+                        curHost->hostIdField(), NULL);
     }
 
     /* DIMM VRD2 fault/warning */
@@ -1439,14 +1590,15 @@ static int logEventVrdWarnFault(EventData data, EventFields eFields)
         eventData[7] = (DIMM_COMPONENT << 4) | data.socket;
         eventData[8] = VRD_2;
         curEventMask[data.idx] = curEventMask[data.idx] | BIT_5;
-        ampere::sel::addSelOem("OEM RAS error:", eventData);
+        ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
 
         snprintf(redFishMsg, MAX_MSG_LEN, "Asserted.");
         snprintf(comp, MAX_MSG_LEN, "Event %s at DIMM_VRD%d of Socket %d",
                  data.eventName, VRD_2, data.socket);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                        NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                        curHost->redfishTag.c_str(), comp, redFishMsg,
+                        curHost->hostIdField(), NULL);
     }
     else if ((!(eFields.data & BIT_5)) && (currentMask & BIT_5))
     {
@@ -1454,14 +1606,15 @@ static int logEventVrdWarnFault(EventData data, EventFields eFields)
         eventData[7] = (DIMM_COMPONENT << 4) | data.socket;
         eventData[8] = VRD_2;
         curEventMask[data.idx] = curEventMask[data.idx] & (0xffff - BIT_5);
-        ampere::sel::addSelOem("OEM RAS error:", eventData);
+        ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
 
         snprintf(redFishMsg, MAX_MSG_LEN, "Deasserted.");
         snprintf(comp, MAX_MSG_LEN, "Event %s at DIMM_VRD%d of Socket %d",
                  data.eventName, VRD_2, data.socket);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                        NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                        curHost->redfishTag.c_str(), comp, redFishMsg,
+                        curHost->hostIdField(), NULL);
     }
 
     /* DIMM VRD3 fault/warning */
@@ -1471,14 +1624,15 @@ static int logEventVrdWarnFault(EventData data, EventFields eFields)
         eventData[7] = (DIMM_COMPONENT << 4) | data.socket;
         eventData[8] = VRD_3;
         curEventMask[data.idx] = curEventMask[data.idx] | BIT_6;
-        ampere::sel::addSelOem("OEM RAS error:", eventData);
+        ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
 
         snprintf(redFishMsg, MAX_MSG_LEN, "Asserted.");
         snprintf(comp, MAX_MSG_LEN, "Event %s at DIMM_VRD%d of Socket %d",
                  data.eventName, VRD_3, data.socket);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                        NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                        curHost->redfishTag.c_str(), comp, redFishMsg,
+                        curHost->hostIdField(), NULL);
     }
     else if ((!(eFields.data & BIT_6)) && (currentMask & BIT_6))
     {
@@ -1486,14 +1640,15 @@ static int logEventVrdWarnFault(EventData data, EventFields eFields)
         eventData[7] = (DIMM_COMPONENT << 4) | data.socket;
         eventData[8] = VRD_3;
         curEventMask[data.idx] = curEventMask[data.idx] & (0xffff - BIT_6);
-        ampere::sel::addSelOem("OEM RAS error:", eventData);
+        ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
 
         snprintf(redFishMsg, MAX_MSG_LEN, "Deasserted.");
         snprintf(comp, MAX_MSG_LEN, "Event %s at DIMM_VRD%d of Socket %d",
                  data.eventName, VRD_3, data.socket);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                    "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                    NULL);
+                    "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                    curHost->redfishTag.c_str(), comp, redFishMsg,
+                    curHost->hostIdField(), NULL);
     }
 
     /* DIMM VRD4 fault/warning */
@@ -1503,14 +1658,15 @@ static int logEventVrdWarnFault(EventData data, EventFields eFields)
         eventData[7] = (DIMM_COMPONENT << 4) | data.socket;
         eventData[8] = VRD_4;
         curEventMask[data.idx] = curEventMask[data.idx] | BIT_7;
-        ampere::sel::addSelOem("OEM RAS error:", eventData);
+        ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
 
         snprintf(redFishMsg, MAX_MSG_LEN, "Asserted.");
         snprintf(comp, MAX_MSG_LEN, "Event %s at DIMM_VRD%d of Socket %d",
                  data.eventName, VRD_4, data.socket);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                        NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                        curHost->redfishTag.c_str(), comp, redFishMsg,
+                        curHost->hostIdField(), NULL);
     }
     else if ((!(eFields.data & BIT_7)) && (currentMask & BIT_7))
     {
@@ -1518,47 +1674,70 @@ static int logEventVrdWarnFault(EventData data, EventFields eFields)
         eventData[7] = (DIMM_COMPONENT << 4) | data.socket;
         eventData[8] = VRD_4;
         curEventMask[data.idx] = curEventMask[data.idx] & (0xffff - BIT_7);
-        ampere::sel::addSelOem("OEM RAS error:", eventData);
+        ampere::sel::addSelOem(curHost->selMessage.c_str(), eventData);
 
         snprintf(redFishMsg, MAX_MSG_LEN, "Deasserted.");
         snprintf(comp, MAX_MSG_LEN, "Event %s at DIMM_VRD%d of Socket %d",
                  data.eventName, VRD_4, data.socket);
         sd_journal_send("REDFISH_MESSAGE_ID=%s", redFishMsgID,
-                        "REDFISH_MESSAGE_ARGS=%s,%s", comp, redFishMsg,
-                        NULL);
+                        "REDFISH_MESSAGE_ARGS=%s%s,%s",
+                        curHost->redfishTag.c_str(), comp, redFishMsg,
+                        curHost->hostIdField(), NULL);
     }
 
     return 1;
 }
 
-static int parseAndLogEvents(EventData data, std::string eventLine)
+/*
+ * Log the changes of the event bits in bits with the given severity. The
+ * other bits are presented to the handlers unchanged so they log nothing.
+ */
+static void logEventBits(EventData data, EventFields eFields,
+                         u_int16_t bits, const char* severity)
 {
-    EventFields eventFields;
-
-    eventLine.erase(std::remove(eventLine.begin(), eventLine.end(), '\n'),
-                  eventLine.end());
-    if (eventLine.size() != 4)
-        return 0;
-    eventFields.type = data.intEventType;
-    eventFields.data = ampere::utils::parseHexStrToUInt16(eventLine);
+    if (!((eFields.data ^ curEventMask[data.idx]) & bits))
+    {
+        return;
+    }
+    eFields.data = (eFields.data & bits) | (curEventMask[data.idx] & ~bits);
 
-    switch (eventFields.type)
+    switch (eFields.type)
     {
         case event_vrd_warn_fault:
-            logEventVrdWarnFault(data, eventFields);
+            logEventVrdWarnFault(data, eFields, severity);
             break;
         case event_vrd_hot:
-            logEventVrdHot(data, eventFields);
+            logEventVrdHot(data, eFields, severity);
             break;
         case event_dimm_hot:
-            logEventDIMMHot(data, eventFields);
+            logEventDIMMHot(data, eFields, severity);
             break;
         case event_dimm_2x_refresh:
-            logEventDIMM2xRefresh(data, eventFields);
+            logEventDIMM2xRefresh(data, eFields, severity);
             break;
         default:
             break;
     }
+}
+
+static int parseAndLogEvents(EventData data, std::string eventLine)
+{
+    EventFields eventFields;
+    u_int16_t drop = eventDropMask[data.idx];
+    u_int16_t critical = eventCriticalMask[data.idx];
+
+    eventLine.erase(std::remove(eventLine.begin(), eventLine.end(), '\n'),
+                  eventLine.end());
+    if (eventLine.size() != 4)
+        return 0;
+    eventFields.type = data.intEventType;
+    eventFields.data = ampere::utils::parseHexStrToUInt16(eventLine);
+
+    /* Dropped bits follow the event state without being logged */
+    curEventMask[data.idx] = (curEventMask[data.idx] & ~drop) |
+                             (eventFields.data & drop);
+    logEventBits(data, eventFields, ~(drop | critical), "Warning");
+    logEventBits(data, eventFields, critical, "Critical");
 
     return 1;
 }
@@ -1590,27 +1769,49 @@ static int logEvents(EventData data, const char *fileName)
     return 1;
 }
 
-static void getErrorsAndEvents()
+static std::string getHostPath(const Host& host, u_int16_t socket,
+                               const char* fileName)
+{
+    if (socket < MAX_SOCKET && host.rootDir[socket] != "")
+    {
+        return host.rootDir[socket] + fileName;
+    }
+
+    return "";
+}
+
+static void getErrorsAndEvents(Host& host)
 {
     std::string filePath;
     u_int8_t index = 0;
 
+    curHost = &host;
+    curEventMask = host.eventMask;
+    if (!host.polled)
+    {
+        host.polled = true;
+        log<level::INFO>("First RAS poll of host",
+                         entry("HOST=%d", host.id),
+                         entry("TIME_TO_FIRST_POLL_MS=%lld",
+                               (long long)std::chrono::duration_cast<
+                                   std::chrono::milliseconds>(
+                                   std::chrono::steady_clock::now() -
+                                   startTime).count()));
+    }
     for(index = 0; index < NUMBER_OF_ERRORS; index ++)
     {
         ErrorData data1 = errorTypeTable[index];
-        filePath = ampere::utils::getAbsolutePath(
-                    data1.socket, data1.label);
+        filePath = getHostPath(host, data1.socket, data1.label);
         if (filePath != "")
         {
-            logErrors(data1, filePath.c_str());
+            logErrors(data1, filePath.c_str(), errorFilters[index].get());
         }
     }
 
     for(index = 0; index < NUMBER_OF_EVENTS; index ++)
     {
         EventData data2 = eventTypeTable[index];
-        filePath = ampere::utils::getAbsolutePath(
-                    data2.socket, data2.label);
+        filePath = getHostPath(host, data2.socket, data2.label);
         if (filePath != "")
         {
             logEvents(data2, filePath.c_str());
@@ -1618,14 +1819,407 @@ static void getErrorsAndEvents()
     }
 }
 
-static void handleHostStateMatch(std::shared_ptr<sdbusplus::asio::connection>& conn)
+/*
+ * Read an optional numeric rule field, given as a number or as a string
+ * such as "0x0f". value is left alone when the field is absent.
+ */
+static bool getFilterField(const Json& rule, const char* name, long max,
+                           long& value)
+{
+    auto it = rule.find(name);
+    std::string str;
+    char* end;
+
+    if (it == rule.end())
+    {
+        return true;
+    }
+    if (it->is_number_unsigned())
+    {
+        value = it->get<long>();
+    }
+    else if (it->is_string())
+    {
+        str = it->get<std::string>();
+        value = strtol(str.c_str(), &end, 0);
+        if (str.empty() || *end != 0)
+        {
+            return false;
+        }
+    }
+    else
+    {
+        return false;
+    }
+
+    return value >= 0 && value <= max;
+}
+
+/* Compile one "event_filters" rule into the filter bitmaps */
+static bool compileFilterRule(const Json& rule)
+{
+    long socket = -1, errType = -1, subType = -1, bits = 0xffff;
+    bool matched = false;
+    bool drop, warning, critical;
+    std::string source, action, severity;
+    u_int8_t index;
+    u_int16_t key;
+
+    if (!rule.is_object())
+    {
+        return false;
+    }
+    source = rule.value("source", "");
+    action = rule.value("action", "");
+    severity = rule.value("severity", "");
+    if (!getFilterField(rule, "socket", 0xff, socket) ||
+        !getFilterField(rule, "err_type", 0xff, errType) ||
+        !getFilterField(rule, "sub_type", 0xff, subType) ||
+        !getFilterField(rule, "bits", 0xffff, bits))
+    {
+        return false;
+    }
+    if (action == "remap" && severity != "Critical" && severity != "Warning")
+    {
+        return false;
+    }
+    if (action != "drop" && action != "keep" && action != "remap")
+    {
+        return false;
+    }
+    drop = action == "drop";
+    warning = action == "remap" && severity == "Warning";
+    critical = action == "remap" && severity == "Critical";
+
+    for (index = 0; index < NUMBER_OF_ERRORS; index++)
+    {
+        ErrorData& data = errorTypeTable[index];
+
+        if (source != data.label || (socket >= 0 && socket != data.socket))
+        {
+            continue;
+        }
+        matched = true;
+        if (data.intErrorType == error_smpro ||
+            data.intErrorType == error_pmpro ||
+            data.intErrorType == warn_smpro ||
+            data.intErrorType == warn_pmpro)
+        {
+            log<level::WARNING>("Internal errors can not be filtered",
+                                entry("SOURCE=%s", data.label));
+            continue;
+        }
+        if (!errorFilters[index])
+        {
+            errorFilters[index] = std::make_unique<ErrorFilter>();
+        }
+        for (long type = 0; type <= 0xff; type++)
+        {
+            if (errType >= 0 && type != errType)
+            {
+                continue;
+            }
+            for (long sub = 0; sub <= 0xff; sub++)
+            {
+                if (subType >= 0 && sub != subType)
+                {
+                    continue;
+                }
+                key = (type << 8) | sub;
+                errorFilters[index]->drop[key] = drop;
+                errorFilters[index]->warning[key] = warning;
+            }
+        }
+    }
+
+    for (index = 0; index < NUMBER_OF_EVENTS; index++)
+    {
+        EventData& data = eventTypeTable[index];
+
+        if (source != data.label || (socket >= 0 && socket != data.socket))
+        {
+            continue;
+        }
+        matched = true;
+        eventDropMask[index] = drop ? eventDropMask[index] | bits :
+                                      eventDropMask[index] & ~bits;
+        eventCriticalMask[index] = critical ?
+                                   eventCriticalMask[index] | bits :
+                                   eventCriticalMask[index] & ~bits;
+    }
+
+    return matched;
+}
+
+/* Load the "event_filters" rules of the platform configuration */
+static void loadEventFilters()
+{
+    Json data;
+    int count = 0;
+    u_int8_t index;
+
+    try
+    {
+        data = ampere::utils::parseConfigFile(
+                    AMPERE_PLATFORM_MGMT_CONFIG_FILE);
+    }
+    catch (const std::exception&)
+    {
+        return;
+    }
+
+    auto rules = data.find("event_filters");
+    if (rules == data.end())
+    {
+        return;
+    }
+    if (!rules->is_array())
+    {
+        log<level::WARNING>("event_filters configuration is invalid."\
+                            " No event is filtered!");
+        return;
+    }
+
+    for (const auto& rule : *rules)
+    {
+        bool valid;
+
+        try
+        {
+            valid = compileFilterRule(rule);
+        }
+        catch (const Json::exception&)
+        {
+            valid = false;
+        }
+        if (!valid)
+        {
+            log<level::WARNING>("Ignoring invalid event filter rule",
+                                entry("RULE=%s", rule.dump().c_str()));
+            continue;
+        }
+        count++;
+    }
+
+    /* Sources left without any filtered error keep the fast path */
+    for (index = 0; index < NUMBER_OF_ERRORS; index++)
+    {
+        if (errorFilters[index] && errorFilters[index]->drop.none() &&
+            errorFilters[index]->warning.none())
+        {
+            errorFilters[index].reset();
+        }
+    }
+    log<level::INFO>("Loaded event filter rules",
+                     entry("COUNT=%d", count));
+}
+
+static void addHost(u_int8_t id, const std::string& statePath,
+                    const std::string rootDir[MAX_SOCKET])
 {
-    rasTimer = std::make_unique<phosphor::Timer>(getErrorsAndEvents);
+    auto host = std::make_unique<Host>();
+    Host* h = host.get();
+
+    host->id = id;
+    host->statePath = statePath;
+    for (u_int8_t socket = 0; socket < MAX_SOCKET; socket++)
+    {
+        host->rootDir[socket] = rootDir[socket];
+    }
+    host->ueFlagPath = RASUEFlagPath;
+    host->selMessage = "OEM RAS error:";
+    host->selId = 0xFF;
+    host->stateService = HOST_STATE_SERVICE;
+    if (!statePath.empty())
+    {
+        /* phosphor-state-manager names the bus of host<N> State.Host<N> */
+        host->stateService += std::to_string(id);
+        host->ueFlagPath += "_host" + std::to_string(id);
+        host->selMessage += " host" + std::to_string(id);
+        host->selId = id;
+        host->redfishTag = "Host" + std::to_string(id) + " ";
+        host->hostIdEntry = "HOST_ID=" + std::to_string(id);
+    }
+    host->timer = std::make_unique<phosphor::Timer>(
+        [h]() { getErrorsAndEvents(*h); });
+    hosts.push_back(std::move(host));
+}
 
+/*
+ * Set up the monitored hosts from the "hosts" array of config.json, or a
+ * single host from the platform errmon paths. Returns the number of hosts.
+ */
+static int initHosts(bool haveRootPath)
+{
+    std::string rootDir[MAX_SOCKET];
+    Json data;
+
+    try
+    {
+        data = ampere::utils::parseConfigFile(
+                    AMPERE_PLATFORM_MGMT_CONFIG_FILE);
+    }
+    catch (const std::exception&)
+    {
+    }
+
+    auto cfg = data.find("hosts");
+    if (!data.is_object() || cfg == data.end())
+    {
+        if (haveRootPath)
+        {
+            for (u_int8_t socket = 0; socket < MAX_SOCKET; socket++)
+            {
+                rootDir[socket] = ampere::utils::hwmonRootDir[socket];
+            }
+            addHost(0, "", rootDir);
+        }
+        return hosts.size();
+    }
+    if (!cfg->is_array())
+    {
+        log<level::ERR>("hosts configuration is invalid.");
+        return 0;
+    }
+
+    for (const auto& hostCfg : *cfg)
+    {
+        bool found = false;
+        int id;
+
+        try
+        {
+            id = hostCfg.value("id", -1);
+            rootDir[0] = hostCfg.value("s0_errmon_path", "");
+            rootDir[1] = hostCfg.value("s1_errmon_path", "");
+        }
+        catch (const Json::exception&)
+        {
+            id = -1;
+        }
+        if (id < 0 || id >= 0xff)
+        {
+            log<level::WARNING>("Ignoring host without a valid id",
+                                entry("HOST=%s", hostCfg.dump().c_str()));
+            continue;
+        }
+        for (u_int8_t socket = 0; socket < MAX_SOCKET; socket++)
+        {
+            if (ampere::utils::isErrmonRootDir(rootDir[socket]))
+            {
+                found = true;
+            }
+            else
+            {
+                rootDir[socket] = "";
+            }
+        }
+        if (!found)
+        {
+            log<level::WARNING>("No SMPro errmon path for host",
+                                entry("HOST=%d", id));
+            continue;
+        }
+        addHost(id, HOST_STATE_PATH + std::to_string(id), rootDir);
+    }
+
+    return hosts.size();
+}
+
+/* Start or stop polling a host on a host state change */
+static void setHostState(Host& host, const std::string& state)
+{
+    bool running = state == HOST_STATE_RUNNING;
+
+    /* Already polling; a stop also clears a stale RAS UE flag */
+    if (running && host.running)
+    {
+        return;
+    }
+    host.running = running;
+
+    if (running)
+    {
+        log<level::INFO>("Host is turned on ", entry("HOST=%d", host.id));
+        getErrorsAndEvents(host);
+        host.timer->start(std::chrono::microseconds(1200000), true);
+    }
+    else
+    {
+        log<level::INFO>("Host is turned off ", entry("HOST=%d", host.id));
+        host.timer->stop();
+        auto p = fs::path(host.ueFlagPath);
+        if(fs::exists(p))
+        {
+            std::string cmd = "rm " + host.ueFlagPath;
+            if(std::system(cmd.c_str()) != 0)
+                log<level::INFO>("remove flag RAS UE failed");
+        }
+    }
+}
+
+/*
+ * Get the current state of a host, so a host already running when the
+ * service starts is polled without waiting for a state change. Sent after
+ * the match is added: a reply older than a signalled change is dropped. A
+ * failed query is retried until it succeeds or a change is signalled.
+ */
+static void queryHostState(std::shared_ptr<sdbusplus::asio::connection> conn,
+                           Host* h)
+{
+    std::string path = h->statePath.empty() ?
+                       std::string(HOST_STATE_PATH) + "0" : h->statePath;
+
+    conn->async_method_call(
+        [h](const boost::system::error_code ec,
+            const std::variant<std::string>& value) {
+            if (h->signalled)
+            {
+                return;
+            }
+            if (ec)
+            {
+                if (!h->stateQueryFailed)
+                {
+                    log<level::WARNING>(
+                        "Failed to get the host state, retrying",
+                        entry("HOST=%d", h->id),
+                        entry("SERVICE=%s", h->stateService.c_str()));
+                }
+                h->stateQueryFailed = true;
+                h->stateRetry->start(HOST_STATE_RETRY, false);
+                return;
+            }
+            auto state = std::get_if<std::string>(&value);
+            if (state == nullptr)
+            {
+                return;
+            }
+            setHostState(*h, *state);
+        },
+        h->stateService, path, "org.freedesktop.DBus.Properties", "Get",
+        HOST_STATE_SERVICE, "CurrentHostState");
+}
+
+static void queryHostStates(std::shared_ptr<sdbusplus::asio::connection>& conn)
+{
+    for (auto& host : hosts)
+    {
+        Host* h = host.get();
+
+        h->stateRetry = std::make_unique<phosphor::Timer>(
+            [conn, h]() { queryHostState(conn, h); });
+        queryHostState(conn, h);
+    }
+}
+
+static void handleHostStateMatch(std::shared_ptr<sdbusplus::asio::connection>& conn)
+{
     auto startEventMatcherCallback = [](sdbusplus::message::message& msg) {
         boost::container::flat_map<std::string, std::variant<std::string>>
             propertiesChanged;
         std::string interfaceName;
+        std::string path = msg.get_path();
 
         msg.read(interfaceName, propertiesChanged);
         if (propertiesChanged.empty())
@@ -1642,26 +2236,19 @@ static void handleHostStateMatch(std::shared_ptr<sdbusplus::asio::connection>& c
             return;
         }
 
-        if (event == "CurrentHostState")
+        if (event != "CurrentHostState")
         {
-            if (*variant ==
-                     "xyz.openbmc_project.State.Host.HostState.Running")
-            {
-                log<level::INFO>("Host is turned on ");
-		getErrorsAndEvents();
-                rasTimer->start(std::chrono::microseconds(1200000), true);
-            }
-            else
+            return;
+        }
+
+        for (auto& host : hosts)
+        {
+            if (!host->statePath.empty() && host->statePath != path)
             {
-                log<level::INFO>("Host is turned off ");
-                rasTimer->stop();
-                auto p = fs::path(RASUEFlagPath);
-                if(fs::exists(p))
-                {
-                    if(std::system(rmFlagCmd) != 0)
-                        log<level::INFO>("remove flag RAS UE failed");
-                }
+                continue;
             }
+            host->signalled = true;
+            setHostState(*host, *variant);
         }
     };
 
@@ -1670,6 +2257,8 @@ static void handleHostStateMatch(std::shared_ptr<sdbusplus::asio::connection>& c
         "type='signal',interface='org.freedesktop.DBus.Properties',member='"
         "PropertiesChanged',arg0namespace='xyz.openbmc_project.State.Host'",
         std::move(startEventMatcherCallback));
+
+    queryHostStates(conn);
 }
 
 } /* namespace ras */
@@ -1693,12 +2282,14 @@ int main()
 
     ampere::sel::initSelUtil(conn);
     ret = ampere::utils::initHwmonRootPath();
-    if (!ret)
+    if (!ampere::ras::initHosts(ret))
     {
         log<level::ERR>("Failed to get Root Path of SMPro Hwmon\n");
         return 1;
     }
 
+    ampere::ras::loadEventFilters();
+
     sdbusplus::asio::sd_event_wrapper sdEvents(io);
 
     ampere::ras::handleHostStateMatch(conn);
@@ -55,16 +55,6 @@ std::string hwmonRootDir[2]     = {
         "/sys/bus/platform/devices/smpro-misc.5.auto"
         };
 
-static std::string getAbsolutePath(u_int8_t socket, std::string fileName)
-{
-    if (hwmonRootDir[socket] != "")
-    {
-        return hwmonRootDir[socket] + fileName;
-    }
-
-    return "";
-}
-
 /** @brief Parsing config JSON file  */
 Json parseConfigFile(const std::string configFile)
 {
@@ -138,6 +128,15 @@ static int parsePlatformConfiguration()
     return 0;
 }
 
+/** @brief Check that dir is an SMPro errmon directory */
+static bool isErrmonRootDir(const std::string& dir)
+{
+    auto path = fs::path(dir);
+
+    return !dir.empty() && fs::exists(path) && fs::is_directory(path) &&
+           fs::exists(fs::path(dir + "/error_core_ce"));
+}
+
 static int initHwmonRootPath()
 {
     bool foundRootPath = false;
@@ -147,15 +146,10 @@ static int initHwmonRootPath()
 
     for (u_int8_t socket=0; socket < NUM_SOCKET; socket++)
     {
-        auto path = fs::path(hwmonRootDir[socket]);
-        if (fs::exists(path) && fs::is_directory(path))
+        if (isErrmonRootDir(hwmonRootDir[socket]))
         {
-            path = fs::path(hwmonRootDir[socket] + "/error_core_ce");
-            if (fs::exists(path))
-            {
-                foundRootPath = true;
-                continue;
-            }
+            foundRootPath = true;
+            continue;
         }
         hwmonRootDir[socket] = "";
     }
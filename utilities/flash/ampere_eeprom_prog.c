@@ -21,17 +21,25 @@
 #include <linux/i2c.h>
 #include <linux/i2c-dev.h>
 #include <netinet/in.h>
+#include <pthread.h>
+#include <stdarg.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 #include <zlib.h>
 
-#pragma pack(1)
-
 #define PERCENTAGE(x, total) (((x)*100) / (total))
+/* Per target output, silenced when several targets are programmed at once */
+#define ctl_printf(c, ...)       \
+	do                           \
+	{                            \
+		if (!(c)->quiet)         \
+			printf(__VA_ARGS__); \
+	} while (0)
 
 enum eeprom_type
 {
@@ -44,28 +52,99 @@ enum eeprom_type
 #define DEFAULT_I2C_BUS              1
 #define DEFAULT_I2C_EEPROM_ADDR      0x50
 #define DEFAULT_I2C_EEPROM_TYPE      EEPROM_24C1024
-#define EEPROM_RD_FLG                0
-#define EEPROM_WR_FLG                1
 #define EEPROM_24C1024_PAGE_SIZE     0x100
 #define EEPROM_24C512_PAGE_SIZE      0x80
 #define EEPROM_24C64_PAGE_SIZE       0x20
 #define EEPROM_24C02_PAGE_SIZE       0x8
 #define EEPROM_MAX_PAGE_SIZE_SUPPORT EEPROM_24C1024_PAGE_SIZE
 #define MAX_EEPROM_ADDR_LEN          2
+/* Each I2C slave address covers 64KB, 0x50 upto 0x53 */
+#define EEPROM_SLAVE_SIZE            0x10000
+/* i2c-dev limits on the length of a message and of a I2C_RDWR transaction */
+#define EEPROM_MAX_READ_MSG_LEN      8192
+#define EEPROM_MAX_READ_MSGS         (EEPROM_SLAVE_SIZE / EEPROM_MAX_READ_MSG_LEN)
+/* Image and read back chunk size while programming, a multiple of pages */
+#define EEPROM_STREAM_CHUNK_SIZE     EEPROM_MAX_READ_MSG_LEN
+/* Targets programmed concurrently with -m */
+#define MAX_TARGETS                  8
+#define TARGET_PROGRESS_INTERVAL_US  (200 * 1000)
+/* Upper bound of a page write cycle, AT24 datasheets specify 5-10ms */
+#define EEPROM_WRITE_CYCLE_TIMEOUT_US (25 * 1000)
+#define EEPROM_ACK_POLL_INTERVAL_US  100
+/* Attempts to write a page that does not read back correctly */
+#define EEPROM_PAGE_WRITE_RETRIES    4
+#define EEPROM_RETRY_BACKOFF_US      (1 * 1000)
 
 struct smpmpro_ctl
 {
 	uint8_t prog_mode;
 	uint8_t detect_mode;
 	uint8_t read_mode;
+	uint8_t diff_mode;
+	uint8_t skip_mode;
 	uint8_t i2c_bus;
 	uint8_t eeprom_addr;
 	uint8_t eeprom_type;
 	char filename[128];
 	uint32_t rc;
+	/* Pages written and verified */
+	uint32_t pages_written;
+	/* Observed page write cycle times, retries included */
+	uint32_t wr_cycles;
+	uint32_t wr_cycle_min_us;
+	uint32_t wr_cycle_max_us;
+	uint64_t wr_cycle_total_us;
+	/* Pages that had to be written more than once */
+	uint32_t wr_retries;
+	/*
+	 * Image layout: populated segments are runs of pages holding data,
+	 * the rest is 0xFF padding
+	 */
+	uint32_t segments;
+	uint32_t populated_pages;
+	uint32_t blank_skipped;
+	/* Multi-target mode */
+	uint8_t quiet;
+	uint32_t image_size;
+	/* Bytes programmed plus bytes read back, updated by the worker */
+	uint32_t progress;
+	int result;
+	/* Last error of a silenced target, reported with its result */
+	char error[128];
 };
 
 static struct smpmpro_ctl ctl;
+static struct smpmpro_ctl targets[MAX_TARGETS];
+static int target_count;
+
+/*
+ * Report an error of the current target. A silenced target keeps the last
+ * one so it does not break into the aggregated progress line.
+ */
+static void ctl_error(struct smpmpro_ctl *c, const char *fmt, ...)
+{
+	va_list ap;
+	size_t len;
+	char *p;
+
+	va_start(ap, fmt);
+	if (!c->quiet)
+	{
+		vprintf(fmt, ap);
+		va_end(ap);
+		return;
+	}
+	vsnprintf(c->error, sizeof(c->error), fmt, ap);
+	va_end(ap);
+
+	for (p = c->error; *p == '\n'; p++)
+		;
+	len = strlen(p);
+	while (len && p[len - 1] == '\n')
+		len--;
+	memmove(c->error, p, len);
+	c->error[len] = '\0';
+}
 
 static void display_usage(void)
 {
@@ -78,8 +157,14 @@ static void display_usage(void)
 	printf("\t\t\t 1:24c04 2:24c64 3:24c1024\n");
 	printf("\t-r <count>\t: read <count> bytes from EEPROM offset 0\n");
 	printf("\t-p\t\t: program the file\n");
+	printf("\t-u\t\t: only program the pages that differ from the EEPROM\n");
+	printf("\t-k\t\t: skip the 0xFF padding pages of the file which are\n");
+	printf("\t\t\t  already blank on the EEPROM\n");
 	printf("\t-d\t\t: detect the EEPROM\n");
 	printf("\t-f <file>\t: The firmware file\n");
+	printf("\t-m <bus>,<addr>,<file>\t: program <file> into the EEPROM at\n");
+	printf("\t\t\t  <addr> on <bus>, may be repeated to program several\n");
+	printf("\t\t\t  EEPROMs in parallel, one worker per I2C bus\n");
 }
 
 /*
@@ -139,6 +224,19 @@ static int prog_arg_handler(int argc, char **argv, int index)
 	return 0;
 }
 
+static int diff_arg_handler(int argc, char **argv, int index)
+{
+	ctl.prog_mode = 1;
+	ctl.diff_mode = 1;
+	return 0;
+}
+
+static int skip_arg_handler(int argc, char **argv, int index)
+{
+	ctl.skip_mode = 1;
+	return 0;
+}
+
 static int file_arg_handler(int argc, char **argv, int index)
 {
 	memset(&ctl.filename, '\0', sizeof(ctl.filename));
@@ -146,6 +244,26 @@ static int file_arg_handler(int argc, char **argv, int index)
 	return 0;
 }
 
+static int target_arg_handler(int argc, char **argv, int index)
+{
+	struct smpmpro_ctl *t;
+	char *arg, *end;
+
+	if (index + 1 >= argc || target_count >= MAX_TARGETS)
+		return -EINVAL;
+	t = &targets[target_count];
+	arg = argv[index + 1];
+	t->i2c_bus = (uint8_t)strtol(arg, &end, 10);
+	if (*end != ',' || t->i2c_bus > 128)
+		return -EINVAL;
+	t->eeprom_addr = (uint8_t)strtol(end + 1, &end, 16);
+	if (*end != ',' || !end[1] || strlen(end + 1) >= sizeof(t->filename))
+		return -EINVAL;
+	strcpy(t->filename, end + 1);
+	target_count++;
+	return 0;
+}
+
 static int detect_arg_handler(int argc, char **argv, int index)
 {
 	ctl.detect_mode = 1;
@@ -159,8 +277,11 @@ static char *arglist[] =
 	"-t",
 	"-r",
 	"-p",
+	"-u",
+	"-k",
 	"-d",
 	"-f",
+	"-m",
 	NULL};
 
 static int (*handlerlist[])(int, char **, int) =
@@ -170,8 +291,11 @@ static int (*handlerlist[])(int, char **, int) =
 	dev_type_arg_handler,
 	read_arg_handler,
 	prog_arg_handler,
+	diff_arg_handler,
+	skip_arg_handler,
 	detect_arg_handler,
 	file_arg_handler,
+	target_arg_handler,
 	NULL};
 
 static void hexdump(char *buf, ssize_t len)
@@ -257,7 +381,6 @@ static int i2c_master_write(int fd, uint8_t slave, uint8_t *data, size_t count)
 	ret = write(fd, data, count);
 	if (ret != count)
 	{
-		printf("Failed to write data to I2C bus\n");
 		ret = -ENODEV;
 		return ret;
 	}
@@ -265,39 +388,109 @@ static int i2c_master_write(int fd, uint8_t slave, uint8_t *data, size_t count)
 	return ret;
 }
 
+/*
+ * Sequential read of data_len bytes from the current EEPROM slave.
+ * A dummy write sets the address, then the data is clocked out by as many
+ * read messages as i2c-dev allows per message, all in one I2C_RDWR
+ * transaction so the address counter keeps incrementing across them.
+ */
 static int i2c_master_read(int fd, uint8_t slave, uint8_t *wr_data, uint8_t *data,
-						   uint16_t offset, size_t data_len)
+						   uint16_t addr_len, size_t data_len)
 {
 	struct i2c_rdwr_ioctl_data ioctl_data;
-	struct i2c_msg i2c_msgs[2];
+	struct i2c_msg i2c_msgs[EEPROM_MAX_READ_MSGS + 1];
+	int nmsgs = 0;
+	size_t len;
 
-	if (data_len > EEPROM_MAX_PAGE_SIZE_SUPPORT)
+	if (data_len > EEPROM_MAX_READ_MSGS * EEPROM_MAX_READ_MSG_LEN)
 	{
-		printf("*** Warning: Sequential read should not exceed %d bytes, \
-                        otherwise the read data will be rolled over!\n",
-			   EEPROM_MAX_PAGE_SIZE_SUPPORT);
+		printf("%s: sequential read of %zu bytes is too long\n", __func__,
+			   data_len);
+		return -1;
 	}
 
 	/* A dummy write operation should be done according to the I2C protocol */
-	ioctl_data.nmsgs = 2;
-	ioctl_data.msgs = i2c_msgs;
-	ioctl_data.msgs[0].len = MAX_EEPROM_ADDR_LEN;
-	ioctl_data.msgs[0].addr = slave;
-	ioctl_data.msgs[0].flags = 0;
-	ioctl_data.msgs[0].buf = wr_data;
+	i2c_msgs[nmsgs].len = addr_len;
+	i2c_msgs[nmsgs].addr = slave;
+	i2c_msgs[nmsgs].flags = 0;
+	i2c_msgs[nmsgs].buf = wr_data;
+	nmsgs++;
+
+	/* Read operations, split by the i2c-dev per message limit */
+	while (data_len > 0)
+	{
+		len = data_len > EEPROM_MAX_READ_MSG_LEN ? EEPROM_MAX_READ_MSG_LEN :
+												   data_len;
+		i2c_msgs[nmsgs].len = len;
+		i2c_msgs[nmsgs].addr = slave;
+		i2c_msgs[nmsgs].flags = I2C_M_RD;
+		i2c_msgs[nmsgs].buf = data;
+		nmsgs++;
+		data += len;
+		data_len -= len;
+	}
 
-	/* Read operation */
-	ioctl_data.msgs[1].len = data_len;
-	ioctl_data.msgs[1].addr = slave;
-	ioctl_data.msgs[1].flags = 1;
-	ioctl_data.msgs[1].buf = data;
+	ioctl_data.nmsgs = nmsgs;
+	ioctl_data.msgs = i2c_msgs;
 
 	if (ioctl(fd, I2C_RDWR, &ioctl_data) < 0)
-	{
-		printf("Failed to read data from EEPROM @0x%x via i2c!\n", slave);
 		return -1;
+
+	return 0;
+}
+
+static uint32_t elapsed_us(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000 +
+		   (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+/*
+ * Wait for the internal write cycle of a page write to complete.
+ * The EEPROM does not acknowledge its address until the cycle is done,
+ * so poll it with a one byte read until it ACKs or the timeout expires.
+ */
+static int eeprom_wait_write_done(int fd, struct smpmpro_ctl *ctl,
+								  uint8_t slave)
+{
+	struct i2c_rdwr_ioctl_data ioctl_data;
+	struct i2c_msg i2c_msg;
+	struct timespec start;
+	uint8_t dummy;
+	uint32_t cycle;
+
+	ioctl_data.nmsgs = 1;
+	ioctl_data.msgs = &i2c_msg;
+	i2c_msg.addr = slave;
+	i2c_msg.flags = I2C_M_RD;
+	i2c_msg.len = 1;
+	i2c_msg.buf = &dummy;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (;;)
+	{
+		usleep(EEPROM_ACK_POLL_INTERVAL_US);
+		cycle = elapsed_us(&start);
+		if (ioctl(fd, I2C_RDWR, &ioctl_data) >= 0)
+			break;
+		if (cycle > EEPROM_WRITE_CYCLE_TIMEOUT_US)
+		{
+			ctl_error(ctl, "%s: EEPROM @0x%x busy for more than %dus\n",
+					  __func__, slave, EEPROM_WRITE_CYCLE_TIMEOUT_US);
+			return -ETIMEDOUT;
+		}
 	}
 
+	if (!ctl->wr_cycles || cycle < ctl->wr_cycle_min_us)
+		ctl->wr_cycle_min_us = cycle;
+	if (cycle > ctl->wr_cycle_max_us)
+		ctl->wr_cycle_max_us = cycle;
+	ctl->wr_cycle_total_us += cycle;
+	ctl->wr_cycles++;
+
 	return 0;
 }
 
@@ -312,151 +505,466 @@ static int detect_eeprom(int fd, struct smpmpro_ctl *ctl)
 	return 0;
 }
 
-static ssize_t eeprom_rd_wr(int fd, struct smpmpro_ctl *ctl, uint32_t offset,
-							uint8_t *buf, ssize_t size, uint8_t rw_flag)
+/*
+ * Fill in the EEPROM offset address for off and return its length.
+ * The slave I2C EEPROM bus addresses start from 0x50 upto 0x53.
+ * Each I2C slave can address a range of 64KB.
+ * Readjust the offset to address a total of 256KB eeprom memory.
+ */
+static uint16_t eeprom_set_addr(struct smpmpro_ctl *ctl, uint32_t off,
+								uint8_t *eeprom_addr, uint8_t *addr_buf)
+{
+	uint16_t off_tmp = (uint16_t)(off % EEPROM_SLAVE_SIZE);
+	uint16_t buf_off = 0;
+
+	*eeprom_addr = ctl->eeprom_addr + off / EEPROM_SLAVE_SIZE;
+
+	if (eeprom_get_pagesize(ctl->eeprom_type) == EEPROM_24C02_PAGE_SIZE)
+	{
+		addr_buf[buf_off++] = off_tmp & 0x00FF;
+	}
+	else
+	{
+		addr_buf[buf_off++] = (off_tmp & 0xFF00) >> 8;
+		addr_buf[buf_off++] = (off_tmp & 0x00FF);
+	}
+
+	return buf_off;
+}
+
+/*
+ * Write one page worth of data at off, which must not cross a page boundary.
+ * The page is read back once written and rewritten on a mismatch, backing
+ * off a little longer each time.
+ */
+static int eeprom_write_page(int fd, struct smpmpro_ctl *ctl, uint32_t off,
+							 uint8_t *data, ssize_t bytes)
 {
-	ssize_t ret, bytes, len;
-	int pagesize;
 	uint8_t wr_buf[EEPROM_MAX_PAGE_SIZE_SUPPORT + MAX_EEPROM_ADDR_LEN];
 	uint8_t rd_buf[EEPROM_MAX_PAGE_SIZE_SUPPORT];
+	uint8_t eeprom_addr;
+	uint16_t buf_off;
+	int retry;
+
+	buf_off = eeprom_set_addr(ctl, off, &eeprom_addr, wr_buf);
+	memcpy(&wr_buf[buf_off], data, bytes);
+	for (retry = 0; retry < EEPROM_PAGE_WRITE_RETRIES; retry++)
+	{
+		if (retry)
+		{
+			usleep(EEPROM_RETRY_BACKOFF_US << (retry - 1));
+			ctl->wr_retries++;
+		}
+		if (i2c_master_write(fd, eeprom_addr, wr_buf, bytes + buf_off) < 0)
+		{
+			ctl_error(ctl, "%s: fail to send data to EEPROM @0x%x\n",
+					  __func__, eeprom_addr);
+			continue;
+		}
+		/* wait for the EEPROM to ACK again once the page is written */
+		if (eeprom_wait_write_done(fd, ctl, eeprom_addr) < 0)
+			continue;
+		if (i2c_master_read(fd, eeprom_addr, wr_buf, rd_buf, buf_off,
+							bytes) < 0)
+		{
+			ctl_error(ctl, "%s: fail to read back page at 0x%x\n",
+					  __func__, off);
+			continue;
+		}
+		if (!memcmp(rd_buf, data, bytes))
+		{
+			ctl->pages_written++;
+			return 0;
+		}
+		ctl_error(ctl, "\n%s: page at 0x%x does not match, retrying\n",
+				  __func__, off);
+	}
+	ctl_error(ctl, "%s: fail to program page at 0x%x\n", __func__, off);
+
+	return -EIO;
+}
+
+/*
+ * Read size bytes at off. Reads run sequentially up to the end of the
+ * current slave, where the address counter would roll over.
+ */
+static int eeprom_read(int fd, struct smpmpro_ctl *ctl, uint32_t off,
+					   uint8_t *buf, ssize_t size)
+{
+	uint8_t addr_buf[MAX_EEPROM_ADDR_LEN];
+	uint8_t eeprom_addr;
+	uint16_t addr_len;
+	ssize_t bytes;
+
+	while (size > 0)
+	{
+		addr_len = eeprom_set_addr(ctl, off, &eeprom_addr, addr_buf);
+		if (addr_len == 1)
+			bytes = 0x100 - off % 0x100;
+		else
+			bytes = EEPROM_SLAVE_SIZE - off % EEPROM_SLAVE_SIZE;
+		if (bytes > size)
+			bytes = size;
+		if (i2c_master_read(fd, eeprom_addr, addr_buf, buf, addr_len,
+							bytes) < 0)
+		{
+			ctl_error(ctl, "%s: fail to read %zd bytes at 0x%x\n", __func__,
+					  bytes, off);
+			return -EIO;
+		}
+		off += bytes;
+		buf += bytes;
+		size -= bytes;
+	}
+
+	return 0;
+}
+
+/*
+ * Read size bytes at offset for -r, reporting the progress once per slave
+ */
+static ssize_t eeprom_read_progress(int fd, struct smpmpro_ctl *ctl,
+									uint32_t offset, uint8_t *buf, ssize_t size)
+{
+	ssize_t bytes, len;
 	uint8_t *p = buf;
-	uint16_t buf_off, off_tmp;
 	uint32_t off;
-	uint8_t eeprom_addr;
 
 	len = size;
-	pagesize = eeprom_get_pagesize(ctl->eeprom_type);
 	off = offset;
 loop:
-	if (rw_flag == EEPROM_WR_FLG)
-		printf("\rPrograming FW file: %d/%d (%d%%)",
-			   (int)(size - len), (int)size,
-			   (int)PERCENTAGE(size - len, size));
-	else
-		printf("\rReading from EEPROM: %d/%d (%d%%)",
-			   (int)(size - len), (int)size,
-			   (int)PERCENTAGE(size - len, size));
-	buf_off = 0;
+	printf("\rReading from EEPROM: %d/%d (%d%%)", (int)(size - len),
+		   (int)size, (int)PERCENTAGE(size - len, size));
 
-	/*
-	 * The slave I2C EEPROM bus addresses start from 0x50 upto 0x53.
-	 * Each I2C slave can address a range of 64KB.
-	 * Readjust the offset to address a total of 256KB eeprom memory.
-	 */
+	bytes = EEPROM_SLAVE_SIZE - off % EEPROM_SLAVE_SIZE;
+	if (bytes > len)
+		bytes = len;
+	if (eeprom_read(fd, ctl, off, p, bytes) < 0)
+		return -EIO;
+	off += bytes;
+	p += bytes;
+	len -= bytes;
+	if (len > 0)
+		goto loop;
 
-	if (off >= 0x30000)
-	{
-		off_tmp = (uint16_t)(off - 0x30000);
-	}
-	else if (off >= 0x20000)
+	return (int)(size - len);
+}
+
+static int page_blank(const uint8_t *buf, ssize_t len)
+{
+	return len > 0 && buf[0] == 0xFF && !memcmp(buf, buf + 1, len - 1);
+}
+
+/*
+ * Read the current contents of the 0xFF padding pages of an image chunk into
+ * cur, one read per run of padding pages.
+ */
+static int read_padding(int fd, struct smpmpro_ctl *ctl, ssize_t off,
+						const uint8_t *img, uint8_t *cur, ssize_t bytes)
+{
+	int pagesize = eeprom_get_pagesize(ctl->eeprom_type);
+	ssize_t pg, end, n;
+
+	for (pg = 0; pg < bytes; pg = end)
 	{
-		off_tmp = (uint16_t)(off - 0x20000);
+		for (end = pg; end < bytes; end += n)
+		{
+			n = bytes - end >= pagesize ? pagesize : bytes - end;
+			if (!page_blank(img + end, n))
+				break;
+		}
+		if (end > pg && eeprom_read(fd, ctl, off + pg, cur + pg, end - pg) < 0)
+			return -EIO;
+		if (end < bytes)
+			end += n;
 	}
-	else if (off >= 0x10000)
+
+	return 0;
+}
+
+/*
+ * Stream the image from fp into the EEPROM one chunk at a time. In diff mode
+ * the current contents of each chunk are read first and only the pages that
+ * differ are written. With -k only the populated segments are written: 0xFF
+ * padding is read first and left alone where the EEPROM is already blank.
+ * Returns the number of pages written.
+ */
+static int program_chunks(int fd, struct smpmpro_ctl *ctl, FILE *fp,
+						  ssize_t sz, uint32_t *crc)
+{
+	uint8_t img[EEPROM_STREAM_CHUNK_SIZE];
+	uint8_t cur[EEPROM_STREAM_CHUNK_SIZE];
+	int pagesize = eeprom_get_pagesize(ctl->eeprom_type);
+	ssize_t off, bytes, pg, n;
+	int changed = 0, blank, in_segment = 0;
+
+	for (off = 0; off < sz; off += bytes)
 	{
-		off_tmp = (uint16_t)(off - 0x10000);
+		__atomic_store_n(&ctl->progress, off, __ATOMIC_RELAXED);
+		ctl_printf(ctl, "\rPrograming FW file: %d/%d (%d%%)", (int)off,
+				   (int)sz, (int)PERCENTAGE(off, sz));
+		bytes = sz - off >= EEPROM_STREAM_CHUNK_SIZE ?
+					EEPROM_STREAM_CHUNK_SIZE : sz - off;
+		if (fread(img, bytes, 1, fp) != 1)
+		{
+			ctl_error(ctl, "%s: fail to read FW file\n", __func__);
+			return -EIO;
+		}
+		*crc = crc32(*crc, img, bytes);
+		if (ctl->diff_mode && eeprom_read(fd, ctl, off, cur, bytes) < 0)
+			return -EIO;
+		if (!ctl->diff_mode && ctl->skip_mode &&
+			read_padding(fd, ctl, off, img, cur, bytes) < 0)
+			return -EIO;
+
+		for (pg = 0; pg < bytes; pg += n)
+		{
+			n = bytes - pg >= pagesize ? pagesize : bytes - pg;
+			blank = page_blank(img + pg, n);
+			if (!blank)
+			{
+				ctl->populated_pages++;
+				ctl->segments += !in_segment;
+			}
+			in_segment = !blank;
+			if ((ctl->diff_mode || (blank && ctl->skip_mode)) &&
+				!memcmp(img + pg, cur + pg, n))
+			{
+				ctl->blank_skipped += blank && !ctl->diff_mode;
+				continue;
+			}
+			if (eeprom_write_page(fd, ctl, off + pg, img + pg, n) < 0)
+				return -EIO;
+			changed++;
+		}
 	}
-	else
-		off_tmp = (uint16_t)off;
+	ctl_printf(ctl, "\rPrograming FW file: %d/%d (100%%)\n", (int)sz,
+			   (int)sz);
 
-	eeprom_addr = ctl->eeprom_addr + off / 0x10000;
+	return changed;
+}
 
-	/* EEPROM offset address */
-	if (pagesize == EEPROM_24C64_PAGE_SIZE ||
-		pagesize == EEPROM_24C512_PAGE_SIZE ||
-		pagesize == EEPROM_24C1024_PAGE_SIZE)
+/*
+ * Read the programmed image back one chunk at a time for its CRC32
+ */
+static int read_back_crc(int fd, struct smpmpro_ctl *ctl, ssize_t sz,
+						 uint32_t *crc)
+{
+	uint8_t cur[EEPROM_STREAM_CHUNK_SIZE];
+	ssize_t off, bytes;
+
+	for (off = 0; off < sz; off += bytes)
 	{
-		wr_buf[buf_off++] = (off_tmp & 0xFF00) >> 8;
-		wr_buf[buf_off++] = (off_tmp & 0x00FF);
+		__atomic_store_n(&ctl->progress, sz + off, __ATOMIC_RELAXED);
+		ctl_printf(ctl, "\rReading from EEPROM: %d/%d (%d%%)", (int)off,
+				   (int)sz, (int)PERCENTAGE(off, sz));
+		bytes = sz - off >= EEPROM_STREAM_CHUNK_SIZE ?
+					EEPROM_STREAM_CHUNK_SIZE : sz - off;
+		if (eeprom_read(fd, ctl, off, cur, bytes) < 0)
+			return -EIO;
+		*crc = crc32(*crc, cur, bytes);
 	}
-	else
+	ctl_printf(ctl, "\rReading from EEPROM: %d/%d (100%%)\n", (int)sz,
+			   (int)sz);
+
+	return 0;
+}
+
+static int program_fw(int fd, struct smpmpro_ctl *ctl, FILE *fp, ssize_t sz)
+{
+	uint32_t crc32_checksum = crc32(0, NULL, 0);
+	uint32_t crc32_readback = crc32(0, NULL, 0);
+	int pagesize, changed, pages;
+
+	pagesize = eeprom_get_pagesize(ctl->eeprom_type);
+	pages = (sz + pagesize - 1) / pagesize;
+	ctl->segments = 0;
+	ctl->populated_pages = 0;
+	ctl->blank_skipped = 0;
+
+	rewind(fp);
+	changed = program_chunks(fd, ctl, fp, sz, &crc32_checksum);
+	if (changed < 0)
 	{
-		wr_buf[buf_off++] = off_tmp & 0x00FF;
+		ctl_printf(ctl, "FAILED\n");
+		return -EIO;
 	}
-	if (len >= pagesize)
-		bytes = pagesize;
-	else
-		bytes = len;
-	if (rw_flag == EEPROM_WR_FLG)
+	if (!ctl->diff_mode && ctl->skip_mode)
+		ctl_printf(ctl, "Image: %u populated segments, %u of %d pages, "
+				   "%u blank padding pages skipped\n", ctl->segments,
+				   ctl->populated_pages, pages, ctl->blank_skipped);
+	if (ctl->diff_mode)
 	{
-		memcpy(&wr_buf[buf_off], p, bytes);
-		ret = i2c_master_write(fd, eeprom_addr, wr_buf, bytes + buf_off);
-		if (ret == -1)
+		ctl_printf(ctl, "Programmed %d of %d pages\n", changed, pages);
+		if (!changed)
 		{
-			printf("%s: fail to send wr data\n", __func__);
-			return -EIO;
+			ctl_printf(ctl, "EEPROM is up to date\n");
+			goto done;
 		}
-		/* delay 10ms for the I2C write is done */
-		usleep(10 * 1000);
 	}
-	else
+	ctl_printf(ctl, "===== Pgming FW file completed =====\n");
+	if (ctl->wr_cycles && !ctl->quiet)
+		printf("Page write cycle: min %uus avg %uus max %uus (%u writes)\n",
+			   ctl->wr_cycle_min_us,
+			   (uint32_t)(ctl->wr_cycle_total_us / ctl->wr_cycles),
+			   ctl->wr_cycle_max_us, ctl->wr_cycles);
+	if (ctl->wr_retries && !ctl->quiet)
+		printf("Page rewrites after verify mismatch or error: %u\n",
+			   ctl->wr_retries);
+
+	if (read_back_crc(fd, ctl, sz, &crc32_readback) < 0)
 	{
-		ret = i2c_master_read(fd, eeprom_addr, wr_buf, rd_buf, buf_off, bytes);
-		if (ret == -1)
-		{
-			printf("%s: fail to read data\n", __func__);
-			return -EIO;
-		}
-		memcpy(p, rd_buf, bytes);
+		ctl_printf(ctl, "FAILED\n");
+		return -EIO;
 	}
-	off += bytes;
-	p += bytes;
-	len -= bytes;
-	if (len > 0)
-		goto loop;
+	ctl_printf(ctl, "===== Reading from EEPROM completed =====\n");
 
-	return (int)(size - len);
+	ctl_printf(ctl, "CRC32 checksum calculation ... ");
+	if (crc32_checksum != crc32_readback)
+	{
+		ctl_printf(ctl, "FAILED. Try to program again!\n");
+		return -EAGAIN;
+	}
+	ctl_printf(ctl, "PASSED\n");
+done:
+	__atomic_store_n(&ctl->progress, 2 * sz, __ATOMIC_RELAXED);
+
+	return 0;
 }
 
-static int program_fw(int fd, struct smpmpro_ctl *ctl, void *buff, ssize_t sz)
+/*
+ * Probe and program a single -m target. The target's output is silenced,
+ * its outcome is left in result for the summary.
+ */
+static int program_target(struct smpmpro_ctl *t)
 {
-	char *buf_tmp;
-	ssize_t bytes_wr, bytes_rd;
-	int ret = 0;
-	uint32_t crc32_checksum;
+	char i2cdev[16];
+	FILE *fp;
+	int fd, ret;
 
-	printf("Programing FW file: 0/%d (0%%)", (int)sz);
-	crc32_checksum = crc32(0, (unsigned char *)buff, sz);
-	bytes_wr = eeprom_rd_wr(fd, ctl, 0, (uint8_t *)buff,
-							sz, EEPROM_WR_FLG);
-	if (bytes_wr == -1)
+	snprintf(i2cdev, sizeof(i2cdev), "/dev/i2c-%d", t->i2c_bus);
+	fd = open(i2cdev, O_RDWR);
+	if (fd < 0)
+		return -ENODEV;
+	if (detect_eeprom(fd, t))
 	{
-		printf("FAILED\n");
-		return -EIO;
+		close(fd);
+		return -ENODEV;
 	}
-	printf("\rPrograming FW file: %d/%d (100%%)\n", (int)sz, (int)sz);
-	printf("===== Pgming FW file completed =====\n");
+	fp = fopen(t->filename, "rb");
+	if (!fp)
+	{
+		close(fd);
+		return -EINVAL;
+	}
+	ret = program_fw(fd, t, fp, t->image_size);
+	fclose(fp);
+	close(fd);
 
-	buf_tmp = malloc(sz);
-	if (!buf_tmp)
+	return ret;
+}
+
+/*
+ * Worker owning one I2C bus, programs its targets one after the other
+ */
+static void *bus_worker(void *arg)
+{
+	struct smpmpro_ctl *first = arg;
+	struct smpmpro_ctl *t;
+
+	for (t = first; t < &targets[target_count]; t++)
 	{
-		printf("Not enough memory\n");
-		return -ENOMEM;
+		if (t->i2c_bus != first->i2c_bus)
+			continue;
+		t->result = program_target(t);
+		/* Count failed targets as done for the aggregated progress */
+		__atomic_store_n(&t->progress, 2 * t->image_size, __ATOMIC_RELAXED);
 	}
-	printf("Reading from EEPROM: 0/%d (0%%)", (int)sz);
-	bytes_rd = eeprom_rd_wr(fd, ctl, 0, (uint8_t *)buf_tmp,
-							sz, EEPROM_RD_FLG);
-	if (bytes_rd == -1)
+
+	return NULL;
+}
+
+/*
+ * Program all -m targets concurrently, one worker per I2C bus
+ */
+static int program_targets(void)
+{
+	pthread_t workers[MAX_TARGETS];
+	int nworkers = 0;
+	uint64_t total = 0, done;
+	struct stat st;
+	int i, j, failed = 0;
+
+	for (i = 0; i < target_count; i++)
 	{
-		printf("FAILED\n");
-		ret = -EIO;
-		goto err;
+		targets[i].eeprom_type = ctl.eeprom_type;
+		targets[i].diff_mode = ctl.diff_mode;
+		targets[i].skip_mode = ctl.skip_mode;
+		targets[i].quiet = 1;
+		if (stat(targets[i].filename, &st) < 0)
+		{
+			printf("Can't open %s for reading\n", targets[i].filename);
+			return -EINVAL;
+		}
+		targets[i].image_size = st.st_size;
+		total += 2 * (uint64_t)st.st_size;
 	}
-	printf("\rReading from EEPROM: %d/%d (100%%)\n", (int)sz, (int)sz);
-	printf("===== Reading from EEPROM completed =====\n");
 
-	printf("CRC32 checksum calculation ... ");
-	if (crc32_checksum != crc32(0, (unsigned char *)buf_tmp, sz))
+	for (i = 0; i < target_count; i++)
 	{
-		printf("FAILED. Try to program again!\n");
-		ret = -EAGAIN;
-		goto err;
+		/* The first target on each bus starts the worker for that bus */
+		for (j = 0; j < i; j++)
+			if (targets[j].i2c_bus == targets[i].i2c_bus)
+				break;
+		if (j < i)
+			continue;
+		if (pthread_create(&workers[nworkers], NULL, bus_worker,
+						   &targets[i]))
+		{
+			printf("Can not start the worker for I2C bus %d\n",
+				   targets[i].i2c_bus);
+			for (j = 0; j < nworkers; j++)
+				pthread_join(workers[j], NULL);
+			return -EAGAIN;
+		}
+		nworkers++;
 	}
-	printf("PASSED\n");
 
-err:
-	free(buf_tmp);
-	return ret;
+	do
+	{
+		usleep(TARGET_PROGRESS_INTERVAL_US);
+		done = 0;
+		for (i = 0; i < target_count; i++)
+			done += __atomic_load_n(&targets[i].progress, __ATOMIC_RELAXED);
+		printf("\rPrograming %d EEPROMs: %d%%", target_count,
+			   total ? (int)PERCENTAGE(done, total) : 100);
+		fflush(stdout);
+	} while (done < total);
+	printf("\n");
+
+	for (i = 0; i < nworkers; i++)
+		pthread_join(workers[i], NULL);
+
+	for (i = 0; i < target_count; i++)
+	{
+		printf("I2C bus %d EEPROM 0x%x %s: ", targets[i].i2c_bus,
+			   targets[i].eeprom_addr, targets[i].filename);
+		if (targets[i].result)
+		{
+			printf("FAILED (%s)", strerror(-targets[i].result));
+			if (targets[i].error[0])
+				printf(": %s", targets[i].error);
+			printf("\n");
+			failed++;
+			continue;
+		}
+		printf("PASSED, %u pages written", targets[i].pages_written);
+		if (targets[i].wr_retries)
+			printf(", %u rewrites", targets[i].wr_retries);
+		printf("\n");
+	}
+
+	return failed ? -EIO : 0;
 }
 
 int main(int argc, char **argv)
@@ -484,6 +992,9 @@ int main(int argc, char **argv)
 	if (!ctl.eeprom_type)
 		ctl.eeprom_type = DEFAULT_I2C_EEPROM_TYPE;
 
+	if (target_count)
+		return program_targets();
+
 	/* Create the device file string */
 	ret = snprintf(i2cdev, sizeof(i2cdev), "/dev/i2c-%d", ctl.i2c_bus);
 	if (ret >= (signed int)sizeof(i2cdev))
@@ -519,8 +1030,7 @@ int main(int argc, char **argv)
 			printf("Not enough memory\n");
 			return -ENOMEM;
 		}
-		sz = eeprom_rd_wr(fd, &ctl, 0, (uint8_t *)buf,
-						  ctl.rc, EEPROM_RD_FLG);
+		sz = eeprom_read_progress(fd, &ctl, 0, (uint8_t *)buf, ctl.rc);
 		if (sz == -1)
 		{
 			printf("FAILED\n");
@@ -541,26 +1051,17 @@ int main(int argc, char **argv)
 	}
 	fseek(fp, 0, SEEK_END);
 	sz = ftell(fp);
-	buf = malloc(sz);
-	if (!buf)
-	{
-		printf("Not enough memory\n");
-		return -ENOMEM;
-	}
-	fseek(fp, 0, SEEK_SET);
-	fread(buf, sz, 1, fp);
 
 	if (ctl.prog_mode)
 	{
-		ret = program_fw(fd, &ctl, buf, sz);
+		ret = program_fw(fd, &ctl, fp, sz);
 		if (ret)
 		{
-			free(buf);
+			fclose(fp);
 			return -EIO;
 		}
 	}
 
-	free(buf);
 	fclose(fp);
 
 	return 0;
@@ -1,16 +1,24 @@
 #include <fcntl.h>
 #include <getopt.h>
 #include <mtd/mtd-user.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <unistd.h>
+#include <zlib.h>
+
+#include "flash_manifest.h"
+#include "flash_progress.h"
+#include "flash_rates.h"
+#include "mtd_flash.h"
 
 #define PROGRAM_NAME "ampere_flashcp"
 #define VERSION "v1.0"
@@ -18,22 +26,19 @@
 /* for debugging purposes only */
 #ifdef DEBUG
 #undef DEBUG
-#define DEBUG(fmt, args...)                  \
+#define DEBUG(...)                           \
   {                                          \
     log_printf(LOG_ERROR, "%d: ", __LINE__); \
-    log_printf(LOG_ERROR, fmt, ##args);      \
+    log_printf(LOG_ERROR, __VA_ARGS__);      \
   }
 #else
 #undef DEBUG
-#define DEBUG(fmt, args...)
+#define DEBUG(...)
 #endif
 
 #define KB(x) ((x) / 1024)
 #define PERCENTAGE(x, total) (((x)*100) / (total))
 
-/* size of read/write buffer */
-#define BUFSIZE (10 * 1024)
-
 /* cmd-line flags */
 #define FLAG_NONE      0x00
 #define FLAG_VERBOSE   0x01
@@ -41,6 +46,33 @@
 #define FLAG_FILENAME  0x04
 #define FLAG_DEVICE    0x08
 #define FLAG_ERASE_ALL 0x10
+#define FLAG_MANIFEST  0x20
+#define FLAG_GEN_MANIFEST 0x40
+#define FLAG_TARGETS   0x80
+#define FLAG_DUMP      0x100
+#define FLAG_PLAN      0x200
+
+/* Manifest block size when generating one without a device at hand */
+#define DEFAULT_MANIFEST_BLOCK_SIZE (64 * 1024)
+
+/* Devices flashed concurrently with -t, how often they are polled for
+ * completion and how often their progress is redrawn */
+#define MAX_TARGETS 8
+#define TARGET_POLL_US (10 * 1000)
+#define TARGET_PROGRESS_INTERVAL_US (500 * 1000)
+
+/* gzip level of -d dumps and the size of the gzip buffer */
+#define DUMP_GZIP_MODE "wb1"
+#define DUMP_GZIP_BUFSIZE (256 * 1024)
+
+/* Long-only options */
+#define OPTION_PROGRESS    0x100
+#define OPTION_PROGRESS_FD 0x101
+#define OPTION_PLAN        0x102
+
+/* Target stages besides enum mtd_flash_stage */
+#define TARGET_IDLE -1
+#define TARGET_DONE -2
 
 /* error levels */
 #define LOG_NORMAL     1
@@ -67,7 +99,13 @@ static void showusage(bool error)
 
 	log_printf(
 			level,
-			"usage: %1$s [ -v | --verbose | -A | --erase-all ] <filename> <device> <offset>\n"
+			"usage: %1$s [ -v | --verbose | -A | --erase-all ] [ -m | --manifest <manifest> ]\n"
+			"              [ --progress=text|json [ --progress-fd=<fd> ] ] [ --plan ]\n"
+			"              <filename> <device> <offset>\n"
+			"       %1$s [ -v | --verbose | -A | --erase-all ]\n"
+			"              -t | --target <filename>,<device>[,<offset>[,<manifest>]] ...\n"
+			"       %1$s -g | --gen-manifest <manifest> <filename> [ <device> ]\n"
+			"       %1$s [ -v | --verbose ] -d | --dump <file> <device>\n"
 			"       %1$s -h | --help\n"
 			"       %1$s -V | --version\n"
 			"\n"
@@ -75,10 +113,30 @@ static void showusage(bool error)
 			"   -v | --verbose   Show progress reports\n"
 			"   -A | --erase-all Erases the whole device regardless of the image "
 			"size\n"
+			"   -m | --manifest  Check the device against the image manifest first:\n"
+			"                    do nothing if it already holds the image, else\n"
+			"                    rewrite only the erase blocks that differ\n"
+			"   -g | --gen-manifest Write the manifest of <filename> and exit. The\n"
+			"                    block size is the erase block size of <device>,\n"
+			"                    64KB when no device is given\n"
+			"   -t | --target    Add an image to copy, up to 8. The targets are\n"
+			"                    flashed concurrently, one thread per device, and a\n"
+			"                    per device summary is printed at the end\n"
+			"   -d | --dump      Back up the whole device into the gzip <file>, with\n"
+			"                    the manifest of its content in <file>.manifest\n"
+			"   --plan           Show what would be erased and written, only the\n"
+			"                    blocks that differ with -m, and the time it\n"
+			"                    would take at the rates measured by earlier\n"
+			"                    runs, without modifying the device\n"
+			"   --progress=json  Write progress as JSON lines, at most 4 per second\n"
+			"                    and device, with the phase, bytes done, total\n"
+			"                    and current MB/s, then a result line per device\n"
+			"   --progress-fd    File descriptor for the JSON progress, default 2\n"
 			"   -V | --version   Show version information and exit\n"
 			"   <filename>       File which you want to copy to flash\n"
 			"   <device>         Flash device to write to (e.g. /dev/mtd0, "
 			"/dev/mtd1, etc.)\n"
+			"                    or MTD partition name (e.g. pnor)\n"
 			"   <offset>         The start offset. Optional, default: 0\n"
 			"\n",
 			PROGRAM_NAME);
@@ -106,253 +164,815 @@ static int safe_open(const char *pathname, int flags)
 	return (fd);
 }
 
-static void safe_read(int fd, const char *filename, void *buf, size_t count,
-		bool verbose)
+/******************************************************************************/
+
+/* One image to copy to one device, run by its own thread with -t */
+struct flash_target {
+	const char *filename;
+	const char *device;
+	const char *manifest;
+	off_t offset;
+	struct mtd_flash flash;
+	int fil_fd;
+	struct stat filestat;
+	pthread_t thread;
+	/* Progress, updated by the target thread with __atomic builtins */
+	int stage;
+	uint64_t done;
+	uint64_t total;
+	struct flash_progress progress;
+	/* Outcome */
+	int result;
+	bool up_to_date;
+	uint64_t elapsed_us;
+	/* --plan estimate, 0 when a rate is unknown */
+	uint64_t plan_us;
+};
+
+static struct flash_target targets[MAX_TARGETS];
+static int target_count;
+static int flags = FLAG_NONE;
+/* --progress=json output, -1 for text progress */
+static int progress_fd = -1;
+
+static void cleanup(void)
 {
-	ssize_t result;
+	int i;
 
-	result = read(fd, buf, count);
-	if (count != result) {
-		if (verbose)
-			log_printf(LOG_NORMAL, "\n");
-		if (result < 0) {
-			log_printf(LOG_ERROR, "While reading data from %s: %m\n", filename);
-			exit(EXIT_FAILURE);
-		}
-		log_printf(LOG_ERROR,
-				"Short read count returned while reading from %s\n", filename);
-		exit(EXIT_FAILURE);
+	for (i = 0; i < target_count; i++) {
+		mtd_flash_close(&targets[i].flash);
+		if (targets[i].fil_fd > 0)
+			close(targets[i].fil_fd);
 	}
 }
 
-static void safe_rewind(int fd, const char *filename)
+static uint64_t now_us(void)
 {
-	if (lseek(fd, 0L, SEEK_SET) < 0) {
-		log_printf(LOG_ERROR, "While seeking to start of %s: %m\n", filename);
-		exit(EXIT_FAILURE);
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void flash_progress(const struct mtd_flash *dev,
+		enum mtd_flash_stage stage, uint64_t done, uint64_t total, void *priv)
+{
+	unsigned long long percent = total ? PERCENTAGE(done, total) : 100;
+
+	if (!flash_progress_due(priv, mtd_flash_stage_name(stage), done, total))
+		return;
+
+	switch (stage) {
+	case MTD_FLASH_ERASE:
+		log_printf(LOG_NORMAL, "\rErasing blocks: %llu/%llu (%llu%%)",
+				(unsigned long long) (done / dev->mtd.erasesize),
+				(unsigned long long) (total / dev->mtd.erasesize), percent);
+		break;
+	case MTD_FLASH_PROGRAM:
+		log_printf(LOG_NORMAL, "\rWriting data: %lluk/%lluk (%llu%%)",
+				(unsigned long long) KB(done), (unsigned long long) KB(total),
+				percent);
+		break;
+	case MTD_FLASH_VERIFY:
+		log_printf(LOG_NORMAL, "\rVerifying data: %lluk/%lluk (%llu%%)",
+				(unsigned long long) KB(done), (unsigned long long) KB(total),
+				percent);
+		break;
+	case MTD_FLASH_READ:
+		log_printf(LOG_NORMAL, "\rReading data: %lluk/%lluk (%llu%%)",
+				(unsigned long long) KB(done), (unsigned long long) KB(total),
+				percent);
+		break;
 	}
+	if (done == total)
+		log_printf(LOG_NORMAL, "\n");
+}
+
+/* With several targets, record progress for the reporting loop in main */
+static void target_progress(const struct mtd_flash *dev,
+		enum mtd_flash_stage stage, uint64_t done, uint64_t total, void *priv)
+{
+	struct flash_target *t = priv;
+
+	__atomic_store_n(&t->stage, stage, __ATOMIC_RELAXED);
+	__atomic_store_n(&t->total, total, __ATOMIC_RELAXED);
+	__atomic_store_n(&t->done, done, __ATOMIC_RELAXED);
+	if (progress_fd >= 0)
+		flash_progress_json_cb(dev, stage, done, total, &t->progress);
 }
 
-static int safe_rewind_offset(int fd, const char *filename, off_t offset)
+static int flash_erase(struct flash_target *t)
 {
-	if (lseek(fd, offset, SEEK_SET) < 0) {
-		log_printf(LOG_ERROR, "While seeking to start of %s: %m\n", filename);
+	uint64_t start = t->offset, length = t->filestat.st_size;
+	int ret;
+
+	if (flags & FLAG_ERASE_ALL) {
+		start = 0;
+		length = t->flash.mtd.size;
+	}
+
+	ret = mtd_flash_erase(&t->flash, start, length);
+	if (ret < 0) {
+		errno = -ret;
+		if (flags & FLAG_VERBOSE && target_count == 1)
+			log_printf(LOG_NORMAL, "\n");
+		log_printf(LOG_ERROR, "While erasing blocks 0x%.8llx-0x%.8llx on %s: %m\n",
+				(unsigned long long) start,
+				(unsigned long long) (start + length), t->device);
+
 		return EXIT_FAILURE;
 	}
 
+	DEBUG("Erased %llu bytes\n", (unsigned long long) length);
+
 	return EXIT_SUCCESS;
 }
 
-/******************************************************************************/
+static int flash_write(struct flash_target *t)
+{
+	int ret;
 
-static int dev_fd = -1;
-static int fil_fd = -1;
-static int flags = FLAG_NONE;
-struct mtd_info_user mtd;
-struct erase_info_user erase;
-struct stat filestat;
+	ret = mtd_flash_program(&t->flash, t->fil_fd, t->offset,
+			t->filestat.st_size);
+	if (ret < 0) {
+		errno = -ret;
+		if (flags & FLAG_VERBOSE && target_count == 1)
+			log_printf(LOG_NORMAL, "\n");
+		log_printf(LOG_ERROR, "While writing %s to 0x%.8llx on %s: %m\n",
+				t->filename, (unsigned long long) t->offset, t->device);
 
-static void cleanup(void)
+		return EXIT_FAILURE;
+	}
+
+	DEBUG("Wrote %llu bytes\n", (unsigned long long) t->filestat.st_size);
+
+	return EXIT_SUCCESS;
+}
+
+static int flash_verify(struct flash_target *t)
 {
-	if (dev_fd > 0)
-		close(dev_fd);
-	if (fil_fd > 0)
-		close(fil_fd);
+	uint64_t mismatch = 0;
+	int ret;
+
+	ret = mtd_flash_verify(&t->flash, t->fil_fd, t->offset,
+			t->filestat.st_size, &mismatch);
+	if (ret < 0 && flags & FLAG_VERBOSE && target_count == 1)
+		log_printf(LOG_NORMAL, "\n");
+	if (ret == -EBADMSG) {
+		log_printf(LOG_ERROR,
+				"%s does not seem to match flash data on %s. First mismatch at "
+						"0x%.8llx-0x%.8llx\n", t->filename, t->device,
+				(unsigned long long) mismatch,
+				(unsigned long long) (mismatch + t->flash.bufsize));
+		return EXIT_FAILURE;
+	}
+	if (ret < 0) {
+		errno = -ret;
+		log_printf(LOG_ERROR, "While verifying %s against %s: %m\n", t->device,
+				t->filename);
+		return EXIT_FAILURE;
+	}
+
+	DEBUG("Verified %llu bytes\n", (unsigned long long) t->filestat.st_size);
+
+	return EXIT_SUCCESS;
 }
 
-static int flash_erase(int dev_fd, off_t offset, const char *device)
+static int gen_manifest(struct flash_target *t)
 {
-	int i = 0;
-	erase.start = 0;
+	struct flash_manifest manifest;
+	uint32_t block_size = DEFAULT_MANIFEST_BLOCK_SIZE;
+	int ret;
+
+	if (t->flash.fd >= 0)
+		block_size = t->flash.mtd.erasesize;
+
+	ret = flash_manifest_generate(&manifest, t->fil_fd, t->filestat.st_size,
+			block_size);
+	if (!ret)
+		ret = flash_manifest_save(&manifest, t->manifest);
+	if (ret < 0) {
+		errno = -ret;
+		log_printf(LOG_ERROR, "While writing the manifest of %s to %s: %m\n",
+				t->filename, t->manifest);
+		flash_manifest_free(&manifest);
+		return EXIT_FAILURE;
+	}
 
-	if (flags & FLAG_ERASE_ALL) {
-		erase.length = mtd.size;
-	} else {
-		/* Erase from the offset */
-		erase.start = offset;
-		erase.length = (filestat.st_size + mtd.erasesize - 1) / mtd.erasesize;
-		erase.length *= mtd.erasesize;
+	log_printf(LOG_NORMAL, "%s: %llu blocks of %u bytes, crc32 %08x\n",
+			t->manifest, (unsigned long long) manifest.blocks,
+			manifest.block_size, manifest.hash);
+	flash_manifest_free(&manifest);
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Load the image manifest of a target, check it against the image itself
+ * and hash the device against it, flagging the differing erase blocks in
+ * *dirty. Sets *full when the
+ * manifest can't be used at this offset and the whole image must be
+ * written instead. On success without *full, the caller frees the manifest
+ * and *dirty.
+ */
+static int flash_diff(struct flash_target *t, struct flash_manifest *manifest,
+		uint8_t **dirty, int64_t *differ, bool *full)
+{
+	uint32_t erasesize = t->flash.mtd.erasesize;
+	struct flash_manifest image;
+	bool stale;
+	int ret;
+
+	*full = false;
+	ret = flash_manifest_load(manifest, t->manifest);
+	if (ret < 0) {
+		errno = -ret;
+		log_printf(LOG_ERROR, "While reading the manifest %s: %m\n",
+				t->manifest);
+		return EXIT_FAILURE;
 	}
 
-	if (flags & FLAG_VERBOSE) {
-		/* if the user wants verbose output, erase 1 block at a time and show
-		 * him/her what's going on */
-		int blocks = erase.length / mtd.erasesize;
-		erase.length = mtd.erasesize;
-		log_printf(LOG_NORMAL, "Erasing blocks: 0/%d (0%%)", blocks);
+	if (manifest->size != (uint64_t) t->filestat.st_size) {
+		log_printf(LOG_ERROR, "%s doesn't describe %s: %llu bytes, expected %llu\n",
+				t->manifest, t->filename, (unsigned long long) manifest->size,
+				(unsigned long long) t->filestat.st_size);
+		flash_manifest_free(manifest);
+		return EXIT_FAILURE;
+	}
+
+	/* A manifest of another image of the same size must not be trusted */
+	ret = flash_manifest_generate(&image, t->fil_fd, t->filestat.st_size,
+			manifest->block_size);
+	if (ret < 0) {
+		errno = -ret;
+		log_printf(LOG_ERROR, "While hashing %s: %m\n", t->filename);
+		flash_manifest_free(manifest);
+		return EXIT_FAILURE;
+	}
+	stale = image.hash != manifest->hash || memcmp(image.block_hash,
+			manifest->block_hash, manifest->blocks * sizeof(*image.block_hash));
+	flash_manifest_free(&image);
+	if (stale) {
+		log_printf(LOG_ERROR, "%s doesn't describe %s: the image hashes differ\n",
+				t->manifest, t->filename);
+		flash_manifest_free(manifest);
+		return EXIT_FAILURE;
+	}
 
-		for (i = 1; i <= blocks; i++) {
-			log_printf(LOG_NORMAL, "\rErasing blocks: %d/%d (%d%%)", i, blocks,
-					PERCENTAGE(i, blocks));
+	if (manifest->block_size != erasesize || t->offset % erasesize) {
+		log_printf(LOG_NORMAL,
+				"%s: block size %u doesn't match the 0x%x erase blocks at "
+						"0x%.8llx, writing the whole image\n", t->manifest,
+				manifest->block_size, erasesize, (unsigned long long) t->offset);
+		flash_manifest_free(manifest);
+		*full = true;
+		return EXIT_SUCCESS;
+	}
 
-			if (ioctl(dev_fd, MEMERASE, &erase) < 0) {
-				log_printf(LOG_NORMAL, "\n");
-				log_printf(LOG_ERROR,
-						"While erasing blocks 0x%.8x-0x%.8x on %s: %m\n",
-						(unsigned int) erase.start,
-						(unsigned int) (erase.start + erase.length), device);
+	*dirty = malloc(manifest->blocks ? manifest->blocks : 1);
+	if (!*dirty) {
+		log_printf(LOG_ERROR, "Out of memory\n");
+		flash_manifest_free(manifest);
+		return EXIT_FAILURE;
+	}
 
-				return EXIT_FAILURE;
-			}
-			erase.start += mtd.erasesize;
+	*differ = flash_manifest_compare(manifest, &t->flash, t->offset, *dirty);
+	if (*differ < 0) {
+		errno = -*differ;
+		log_printf(LOG_ERROR, "While hashing %s: %m\n", t->device);
+		free(*dirty);
+		flash_manifest_free(manifest);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Hash the device against the image manifest and rewrite only the erase
+ * blocks that differ, then verify the whole image. Sets *full when the
+ * whole image must be written instead.
+ */
+static int flash_update(struct flash_target *t, bool *full)
+{
+	struct flash_manifest manifest;
+	uint32_t erasesize = t->flash.mtd.erasesize;
+	uint64_t block, end, start, length;
+	mtd_flash_progress_t progress = t->flash.progress;
+	void *priv = t->flash.priv;
+	uint8_t *dirty;
+	int64_t differ;
+	int ret;
+
+	ret = flash_diff(t, &manifest, &dirty, &differ, full);
+	if (ret != EXIT_SUCCESS || *full)
+		return ret;
+	if (!differ) {
+		log_printf(LOG_NORMAL, "%s already holds %s, nothing to do\n",
+				t->device, t->filename);
+		t->up_to_date = true;
+		ret = EXIT_SUCCESS;
+		goto out;
+	}
+
+	log_printf(LOG_NORMAL, "%s: rewriting %lld of %llu erase blocks\n",
+			t->device, (long long) differ, (unsigned long long) manifest.blocks);
+
+	/* Erase and program each run of differing blocks */
+	mtd_flash_set_progress(&t->flash, NULL, NULL);
+	for (block = 0; block < manifest.blocks; block = end) {
+		if (!dirty[block]) {
+			end = block + 1;
+			continue;
 		}
+		for (end = block; end < manifest.blocks && dirty[end]; end++)
+			;
+		start = block * erasesize;
+		length = end * erasesize < manifest.size ? end * erasesize - start :
+				manifest.size - start;
 
-		log_printf(LOG_NORMAL, "\rErasing blocks: %d/%d (100%%)\n", blocks,
-				blocks);
-	} else {
-		/* if not, erase the whole chunk in one shot */
-		if (ioctl(dev_fd, MEMERASE, &erase) < 0) {
+		if (flags & FLAG_VERBOSE)
+			log_printf(LOG_NORMAL, "%s: updating 0x%.8llx-0x%.8llx\n",
+					t->device, (unsigned long long) (t->offset + start),
+					(unsigned long long) (t->offset + start + length));
+		ret = mtd_flash_erase(&t->flash, t->offset + start, length);
+		if (ret < 0) {
+			errno = -ret;
 			log_printf(LOG_ERROR,
-					"While erasing blocks from 0x%.8x-0x%.8x on %s: %m\n",
-					(unsigned int) erase.start,
-					(unsigned int) (erase.start + erase.length), device);
-
-			return EXIT_FAILURE;
+					"While erasing blocks 0x%.8llx-0x%.8llx on %s: %m\n",
+					(unsigned long long) (t->offset + start),
+					(unsigned long long) (t->offset + start + length),
+					t->device);
+			ret = EXIT_FAILURE;
+			goto out;
+		}
+		ret = mtd_flash_program_range(&t->flash, t->fil_fd, start,
+				t->offset + start, length);
+		if (ret < 0) {
+			errno = -ret;
+			log_printf(LOG_ERROR, "While writing %s to 0x%.8llx on %s: %m\n",
+					t->filename, (unsigned long long) (t->offset + start),
+					t->device);
+			ret = EXIT_FAILURE;
+			goto out;
 		}
 	}
+	mtd_flash_set_progress(&t->flash, progress, priv);
 
-	DEBUG("Erased %u / %luk bytes\n", erase.length, filestat.st_size);
+	/* The untouched blocks are only known by their hash: check them too */
+	ret = flash_verify(t);
 
-	return EXIT_SUCCESS;
+out:
+	mtd_flash_set_progress(&t->flash, progress, priv);
+	free(dirty);
+	flash_manifest_free(&manifest);
+
+	return ret;
 }
 
-static int flash_write(int dev_fd, int fil_fd, off_t offset, const char *device,
-		const char *filename)
+/* State of a -d dump */
+struct flash_dump {
+	gzFile gz;
+	struct flash_manifest manifest;
+};
+
+static int flash_dump_consume(const void *buf, size_t count, uint64_t pos,
+		void *priv)
 {
-	int i = 0;
-	size_t size, written;
-	ssize_t result;
-	unsigned char src[BUFSIZE], dest[BUFSIZE];
+	struct flash_dump *dump = priv;
 
-	if (flags & FLAG_VERBOSE)
-		log_printf(LOG_NORMAL, "Writing data: 0k/%lluk (0%%)",
-				KB((unsigned long long )filestat.st_size));
+	flash_manifest_update(&dump->manifest, pos, buf, count);
+	if (gzwrite(dump->gz, buf, count) != (int) count)
+		return -EIO;
 
-	size = filestat.st_size;
-	i = BUFSIZE;
-	written = 0;
+	return 0;
+}
 
-	/* if offset is greater than 0 */
-	if (offset)
-		if (safe_rewind_offset(dev_fd, device, offset) != EXIT_SUCCESS)
-			return EXIT_FAILURE;
+/*
+ * Back up a whole device: stream it into a gzip file, with the device reads
+ * overlapping the compression, and write the manifest of the uncompressed
+ * content next to it as <file>.manifest.
+ */
+static int flash_dump(struct flash_target *t)
+{
+	char manifest_path[PATH_MAX];
+	struct flash_dump dump;
+	uint64_t start = now_us(), elapsed, size = t->flash.mtd.size;
+	struct stat st;
+	int fd, ret;
+
+	if (snprintf(manifest_path, sizeof(manifest_path), "%s.manifest",
+			t->filename) >= (int) sizeof(manifest_path)) {
+		log_printf(LOG_ERROR, "%s: file name too long\n", t->filename);
+		return EXIT_FAILURE;
+	}
 
-	while (size) {
-		if (size < BUFSIZE)
-			i = size;
-		if (flags & FLAG_VERBOSE)
-			log_printf(LOG_NORMAL, "\rWriting data: %dk/%lluk (%llu%%)",
-					KB(written + i), KB((unsigned long long )filestat.st_size),
-					PERCENTAGE(written + i,
-							(unsigned long long )filestat.st_size));
-
-		/* read from filename */
-		safe_read(fil_fd, filename, src, i, flags & FLAG_VERBOSE);
-
-		/* write to device */
-		result = write(dev_fd, src, i);
-		if (i != result) {
-			if (flags & FLAG_VERBOSE)
-				log_printf(LOG_NORMAL, "\n");
-			if (result < 0) {
-				log_printf(LOG_ERROR,
-						"While writing data to 0x%.8lx-0x%.8lx on %s: %m\n",
-						written, written + i, device);
+	ret = flash_manifest_init(&dump.manifest, size, t->flash.mtd.erasesize);
+	if (ret < 0) {
+		log_printf(LOG_ERROR, "Out of memory\n");
+		return EXIT_FAILURE;
+	}
 
-				return EXIT_FAILURE;
-			}
+	fd = open(t->filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		log_printf(LOG_ERROR, "While trying to open %s for write access: %m\n",
+				t->filename);
+		flash_manifest_free(&dump.manifest);
+		return EXIT_FAILURE;
+	}
+	dump.gz = gzdopen(fd, DUMP_GZIP_MODE);
+	if (!dump.gz) {
+		log_printf(LOG_ERROR, "Out of memory\n");
+		close(fd);
+		flash_manifest_free(&dump.manifest);
+		return EXIT_FAILURE;
+	}
+	gzbuffer(dump.gz, DUMP_GZIP_BUFSIZE);
+
+	ret = mtd_flash_stream(&t->flash, 0, size, flash_dump_consume, &dump);
+	if (gzclose(dump.gz) != Z_OK && !ret)
+		ret = -EIO;
+	if (!ret)
+		ret = flash_manifest_save(&dump.manifest, manifest_path);
+	if (ret < 0) {
+		errno = -ret;
+		if (flags & FLAG_VERBOSE && progress_fd < 0)
+			log_printf(LOG_NORMAL, "\n");
+		log_printf(LOG_ERROR, "While dumping %s to %s: %m\n", t->device,
+				t->filename);
+		unlink(t->filename);
+		flash_manifest_free(&dump.manifest);
+		return EXIT_FAILURE;
+	}
 
-			log_printf(LOG_ERROR,
-					"Short write count returned while writing to x%.8zx-0x%.8zx "
-							"on %s: %zu/%llu bytes written to flash\n", written,
-					written + i, device, written + result,
-					(unsigned long long) filestat.st_size);
+	elapsed = now_us() - start;
+	t->elapsed_us = elapsed;
+	if (stat(t->filename, &st) < 0)
+		st.st_size = 0;
+	log_printf(LOG_NORMAL,
+			"%s: %lluk -> %lluk in %llu.%03llus (%llu KB/s), crc32 %08x, "
+					"manifest %s\n", t->filename, (unsigned long long) KB(size),
+			(unsigned long long) KB(st.st_size),
+			(unsigned long long) (elapsed / 1000000),
+			(unsigned long long) (elapsed / 1000 % 1000),
+			(unsigned long long) (elapsed ? size * 1000000 / 1024 / elapsed : 0),
+			dump.manifest.hash, manifest_path);
+	flash_manifest_free(&dump.manifest);
 
-			return EXIT_FAILURE;
-		}
+	return EXIT_SUCCESS;
+}
 
-		written += i;
-		size -= i;
+/* Time to move bytes at a cached rate, *unknown set when it isn't cached */
+static uint64_t plan_us(uint64_t bytes, uint64_t rate, bool *unknown)
+{
+	if (!bytes)
+		return 0;
+	if (!rate) {
+		*unknown = true;
+		return 0;
 	}
 
-	if (flags & FLAG_VERBOSE)
-		log_printf(LOG_NORMAL, "\rWriting data: %lluk/%lluk (100%%)\n",
-				KB((unsigned long long )filestat.st_size),
-				KB((unsigned long long )filestat.st_size));
+	return bytes * 1000000 / rate;
+}
 
-	DEBUG("Wrote %d / %lluk bytes\n", written,
-			(unsigned long long)filestat.st_size);
+/*
+ * --plan: work out what a run would erase, write and read without
+ * modifying the device, and estimate its duration from the rates measured
+ * on this device by earlier runs.
+ */
+static int flash_plan(struct flash_target *t)
+{
+	uint32_t erasesize = t->flash.mtd.erasesize;
+	uint64_t size = t->filestat.st_size, erase = 0, written = 0, read = 0;
+	uint64_t block, blocks, start, estimate;
+	struct flash_manifest manifest;
+	struct flash_rates rates;
+	const char *mode = "full";
+	bool full = true, unknown = false;
+	uint8_t *dirty;
+	int64_t differ;
+	int ret;
+
+	if (t->manifest && !(flags & FLAG_ERASE_ALL)) {
+		ret = flash_diff(t, &manifest, &dirty, &differ, &full);
+		if (ret != EXIT_SUCCESS)
+			return ret;
+	}
+
+	if (full) {
+		erase = flags & FLAG_ERASE_ALL ? t->flash.mtd.size :
+				mtd_flash_blocks(&t->flash,
+						t->offset % erasesize + size) * erasesize;
+		written = size;
+		read = size;
+	} else {
+		mode = differ ? "differential" : "up to date";
+		read = size;
+		for (block = 0; block < manifest.blocks; block++) {
+			if (!dirty[block])
+				continue;
+			start = block * erasesize;
+			erase += erasesize;
+			written += size - start < erasesize ? size - start : erasesize;
+		}
+		if (differ)
+			read += size;
+		free(dirty);
+		flash_manifest_free(&manifest);
+	}
+
+	flash_rates_get(&t->flash, &rates);
+	estimate = plan_us(erase, rates.erase, &unknown) +
+			plan_us(written, rates.write, &unknown) +
+			plan_us(read, rates.read, &unknown);
+	t->plan_us = unknown ? 0 : estimate;
+	blocks = mtd_flash_blocks(&t->flash, t->offset % erasesize + size);
+
+	log_printf(LOG_NORMAL, "%s: %s, erase %llu of %llu blocks (%lluk), "
+			"write %lluk, read %lluk, ", t->device, mode,
+			(unsigned long long) (erase / erasesize),
+			(unsigned long long) blocks, (unsigned long long) KB(erase),
+			(unsigned long long) KB(written), (unsigned long long) KB(read));
+	if (unknown)
+		log_printf(LOG_NORMAL, "no measured rates in %s yet\n",
+				FLASH_RATES_FILE);
+	else
+		log_printf(LOG_NORMAL, "estimated %llu.%03llus\n",
+				(unsigned long long) (estimate / 1000000),
+				(unsigned long long) (estimate / 1000 % 1000));
+
+	if (progress_fd >= 0)
+		dprintf(progress_fd, "{\"device\":\"%s\",\"phase\":\"plan\","
+				"\"mode\":\"%s\",\"erase_bytes\":%llu,\"write_bytes\":%llu,"
+				"\"read_bytes\":%llu,\"estimate_ms\":%lld}\n", t->device, mode,
+				(unsigned long long) erase, (unsigned long long) written,
+				(unsigned long long) read,
+				unknown ? -1LL : (long long) (estimate / 1000));
 
 	return EXIT_SUCCESS;
 }
 
-static int flash_verify(int dev_fd, int fil_fd, off_t offset,
-		const char *device, const char *filename)
+/* Remember the rates measured by a successful run for --plan */
+static void record_rates(struct flash_target *t)
 {
-	int i = BUFSIZE;
-	size_t size = 0;
-	unsigned char src[BUFSIZE], dest[BUFSIZE];
+	int ret;
+
+	if (t->result != EXIT_SUCCESS)
+		return;
+	ret = flash_rates_record(&t->flash);
+	if (ret < 0 && flags & FLAG_VERBOSE) {
+		errno = -ret;
+		log_printf(LOG_ERROR, "Warning: can't record the rates of %s in %s: %m\n",
+				t->device, FLASH_RATES_FILE);
+	}
+}
 
-	safe_rewind(fil_fd, filename);
-	safe_rewind_offset(dev_fd, device, offset);
-	size = filestat.st_size;
+/* Erase, write and verify one target, or update it from its manifest */
+static int flash_target_run(struct flash_target *t)
+{
+	bool full = true;
+	int ret;
+
+	if (t->manifest && flags & FLAG_ERASE_ALL)
+		log_printf(LOG_NORMAL, "Erasing the whole device, ignoring %s\n",
+				t->manifest);
+	else if (t->manifest) {
+		ret = flash_update(t, &full);
+		if (!full)
+			return ret;
+	}
 
-	size_t written = 0;
+	/* Erase flash partition based on the input file size */
+	if (flash_erase(t) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
 
-	if (flags & FLAG_VERBOSE)
-		log_printf(LOG_NORMAL, "Verifying data: 0k/%lluk (0%%)",
-				KB((unsigned long long )filestat.st_size));
+	/* Write the entire file to flash */
+	if (flash_write(t) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
 
-	while (size) {
-		if (size < BUFSIZE)
-			i = size;
-		if (flags & FLAG_VERBOSE)
-			log_printf(LOG_NORMAL, "\rVerifying data: %luk/%lluk (%llu%%)",
-					KB(written + i), KB((unsigned long long )filestat.st_size),
-					PERCENTAGE(written + i,
-							(unsigned long long )filestat.st_size));
+	/* Verify that flash == file data */
+	return flash_verify(t);
+}
 
-		/* read from filename */
-		safe_read(fil_fd, filename, src, i, flags & FLAG_VERBOSE);
+static void *flash_target_thread(void *arg)
+{
+	struct flash_target *t = arg;
+	uint64_t start = now_us();
 
-		/* read from device */
-		safe_read(dev_fd, device, dest, i, flags & FLAG_VERBOSE);
+	t->result = flash_target_run(t);
+	t->elapsed_us = now_us() - start;
+	__atomic_store_n(&t->stage, TARGET_DONE, __ATOMIC_RELEASE);
 
-		/* compare buffers */
-		if (memcmp(src, dest, i)) {
-			log_printf(LOG_ERROR,
-					"File does not seem to match flash data. First mismatch at "
-							"0x%.8zx-0x%.8zx\n", written, written + i);
-			return EXIT_FAILURE;
+	return NULL;
+}
+
+/* Open the device of a target. Runs before any thread, failures exit. */
+static void flash_target_open_device(struct flash_target *t)
+{
+	int ret, i;
+
+	/*
+	 * get some info about the flash device, accepting an MTD partition
+	 * name in place of the device node
+	 */
+	ret = mtd_flash_open(&t->flash, t->device);
+	if (ret == -ENOTTY || ret == -EINVAL) {
+		log_printf(LOG_ERROR,
+				"%s doesn't seem to be a valid MTD flash device!\n", t->device);
+		exit(EXIT_FAILURE);
+	}
+	if (ret < 0) {
+		errno = -ret;
+		log_printf(LOG_ERROR, "While trying to open %s: %m\n", t->device);
+		exit(EXIT_FAILURE);
+	}
+	t->device = t->flash.path;
+	flash_progress_init(&t->progress, progress_fd);
+	for (i = 0; &targets[i] != t; i++) {
+		if (!strcmp(targets[i].device, t->device)) {
+			log_printf(LOG_ERROR, "%s is given more than once\n", t->device);
+			exit(EXIT_FAILURE);
 		}
+	}
+}
+
+/*
+ * Open the device and the image of a target and check that the image fits.
+ * Runs before any thread is started, so failures just exit.
+ */
+static void flash_target_open(struct flash_target *t)
+{
+	flash_target_open_device(t);
+
+	/* get some info about the file we want to copy */
+	t->fil_fd = safe_open(t->filename, O_RDONLY);
+	if (fstat(t->fil_fd, &t->filestat) < 0) {
+		log_printf(LOG_ERROR, "While trying to get the file status of %s: %m\n",
+				t->filename);
+		exit(EXIT_FAILURE);
+	}
 
-		written += i;
-		size -= i;
+	/* does it fit into the device/partition? */
+	if (t->filestat.st_size > t->flash.mtd.size) {
+		log_printf(LOG_ERROR, "%s won't fit into %s!\n", t->filename,
+				t->device);
+		exit(EXIT_FAILURE);
 	}
 
-	if (flags & FLAG_VERBOSE)
-		log_printf(LOG_NORMAL, "\rVerifying data: %lluk/%lluk (100%%)\n",
-				KB((unsigned long long )filestat.st_size),
-				KB((unsigned long long )filestat.st_size));
+	/* does offset is out of the mtd */
+	if (t->offset > t->flash.mtd.size) {
+		log_printf(LOG_ERROR, "%s offset won't fit into %s!\n", t->filename,
+				t->device);
+		exit(EXIT_FAILURE);
+	}
+}
 
-	DEBUG("Verified %d / %lluk bytes\n", written,
-			(unsigned long long)filestat.st_size);
+/* Parse <filename>,<device>[,<offset>[,<manifest>]] */
+static void add_target(char *arg)
+{
+	struct flash_target *t;
+	char *offset;
 
-	return EXIT_SUCCESS;
+	if (target_count == MAX_TARGETS) {
+		log_printf(LOG_ERROR, "At most %d targets are supported\n",
+				MAX_TARGETS);
+		exit(EXIT_FAILURE);
+	}
+	t = &targets[target_count++];
+	t->fil_fd = -1;
+	t->flash.fd = -1;
+	t->filename = strtok(arg, ",");
+	t->device = strtok(NULL, ",");
+	offset = strtok(NULL, ",");
+	t->manifest = strtok(NULL, ",");
+	if (!t->filename || !t->device || strtok(NULL, ",")) {
+		log_printf(LOG_ERROR, "Invalid target: %s\n", arg);
+		showusage(true);
+	}
+	t->offset = offset ? strtoul(offset, NULL, 16) : 0;
+}
+
+static const char *target_result(const struct flash_target *t)
+{
+	if (t->result != EXIT_SUCCESS)
+		return "failed";
+
+	return t->up_to_date ? "up to date" : "ok";
+}
+
+static const char *target_stage(int stage)
+{
+	switch (stage) {
+	case MTD_FLASH_ERASE:
+		return "erasing";
+	case MTD_FLASH_PROGRAM:
+		return "writing";
+	case MTD_FLASH_VERIFY:
+		return "verifying";
+	case MTD_FLASH_READ:
+		return "reading";
+	case TARGET_DONE:
+		return "done";
+	}
+
+	return "checking";
+}
+
+/*
+ * Run every target in its own thread, showing each device's progress on
+ * one line with -v, then report per device results and the wall-clock
+ * time against the time the devices would have taken one after another.
+ */
+static int flash_targets(void)
+{
+	uint64_t start = now_us(), shown = start, wall, serial = 0, done, total;
+	int i, running, stage, failed = 0;
+	bool show;
+	struct flash_target *t;
+
+	for (i = 0; i < target_count; i++) {
+		t = &targets[i];
+		t->stage = TARGET_IDLE;
+		mtd_flash_set_progress(&t->flash, target_progress, t);
+		if (pthread_create(&t->thread, NULL, flash_target_thread, t)) {
+			log_printf(LOG_ERROR, "Can't start a thread for %s\n", t->device);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	do {
+		usleep(TARGET_POLL_US);
+		running = 0;
+		for (i = 0; i < target_count; i++)
+			running += __atomic_load_n(&targets[i].stage, __ATOMIC_ACQUIRE)
+					!= TARGET_DONE;
+		show = flags & FLAG_VERBOSE &&
+				(!running || now_us() - shown >= TARGET_PROGRESS_INTERVAL_US);
+		if (!show)
+			continue;
+		shown = now_us();
+		log_printf(LOG_NORMAL, "\r");
+		for (i = 0; i < target_count; i++) {
+			t = &targets[i];
+			stage = __atomic_load_n(&t->stage, __ATOMIC_ACQUIRE);
+			done = __atomic_load_n(&t->done, __ATOMIC_RELAXED);
+			total = __atomic_load_n(&t->total, __ATOMIC_RELAXED);
+			log_printf(LOG_NORMAL, "%s%s: %s %llu%%", i ? "  " : "",
+					t->device, target_stage(stage),
+					total && stage != TARGET_DONE ?
+							PERCENTAGE(done, total) : 100ULL);
+		}
+	} while (running);
+	wall = now_us() - start;
+	if (flags & FLAG_VERBOSE)
+		log_printf(LOG_NORMAL, "\n");
+
+	for (i = 0; i < target_count; i++) {
+		t = &targets[i];
+		pthread_join(t->thread, NULL);
+		record_rates(t);
+		serial += t->elapsed_us;
+		failed += t->result != EXIT_SUCCESS;
+		flash_progress_json_result(&t->progress, t->device, target_result(t),
+				t->elapsed_us);
+		log_printf(LOG_NORMAL, "%s: %s, %s at 0x%.8llx, %llu.%03llus\n",
+				t->device, target_result(t), t->filename, (unsigned long long) t->offset,
+				(unsigned long long) (t->elapsed_us / 1000000),
+				(unsigned long long) (t->elapsed_us / 1000 % 1000));
+	}
+	log_printf(LOG_NORMAL,
+			"%d of %d devices flashed in %llu.%03llus (%llu.%03llus one after "
+					"another)\n", target_count - failed, target_count,
+			(unsigned long long) (wall / 1000000),
+			(unsigned long long) (wall / 1000 % 1000),
+			(unsigned long long) (serial / 1000000),
+			(unsigned long long) (serial / 1000 % 1000));
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
 int main(int argc, char *argv[])
 {
-	const char *filename = NULL, *device = NULL;
-	off_t offset;
+	struct flash_target *t;
+	const char *manifest_path = NULL, *dump_path = NULL;
+	bool json = false;
+	char *end;
+	int i;
 
 	for (;;) {
 		int option_index = 0;
-		static const char *short_options = "hvAV";
+		static const char *short_options = "hvAm:g:t:d:V";
 		static const struct option long_options[] = {
 				{ "help", no_argument, 0, 'h' },
 				{ "verbose", no_argument, 0, 'v' },
 				{ "erase-all", no_argument, 0, 'A' },
+				{ "manifest", required_argument, 0, 'm' },
+				{ "gen-manifest", required_argument, 0, 'g' },
+				{ "target", required_argument, 0, 't' },
+				{ "dump", required_argument, 0, 'd' },
+				{ "progress", required_argument, 0, OPTION_PROGRESS },
+				{ "progress-fd", required_argument, 0, OPTION_PROGRESS_FD },
+				{ "plan", no_argument, 0, OPTION_PLAN },
 				{ "version", no_argument, 0, 'V' },
 				{ 0, 0, 0, 0 },
 		};
@@ -376,6 +996,44 @@ int main(int argc, char *argv[])
 			flags |= FLAG_ERASE_ALL;
 			DEBUG("Got FLAG_ERASE_ALL\n");
 			break;
+		case 'm':
+			flags |= FLAG_MANIFEST;
+			manifest_path = optarg;
+			DEBUG("Got FLAG_MANIFEST: %s\n", manifest_path);
+			break;
+		case 'g':
+			flags |= FLAG_GEN_MANIFEST;
+			manifest_path = optarg;
+			DEBUG("Got FLAG_GEN_MANIFEST: %s\n", manifest_path);
+			break;
+		case 't':
+			flags |= FLAG_TARGETS;
+			add_target(optarg);
+			DEBUG("Got target: %s\n", optarg);
+			break;
+		case 'd':
+			flags |= FLAG_DUMP;
+			dump_path = optarg;
+			DEBUG("Got FLAG_DUMP: %s\n", dump_path);
+			break;
+		case OPTION_PLAN:
+			flags |= FLAG_PLAN;
+			DEBUG("Got FLAG_PLAN\n");
+			break;
+		case OPTION_PROGRESS:
+			if (strcmp(optarg, "json") && strcmp(optarg, "text")) {
+				log_printf(LOG_ERROR, "Unknown progress format: %s\n", optarg);
+				showusage(true);
+			}
+			json = !strcmp(optarg, "json");
+			break;
+		case OPTION_PROGRESS_FD:
+			progress_fd = strtol(optarg, &end, 10);
+			if (*end || progress_fd < 0 || fcntl(progress_fd, F_GETFD) < 0) {
+				log_printf(LOG_ERROR, "Invalid progress fd: %s\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
 		case 'V':
 			common_print_version();
 			exit(EXIT_SUCCESS);
@@ -386,77 +1044,141 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	if (optind + 3 == argc) {
-		flags |= FLAG_FILENAME;
-		filename = argv[optind];
-		DEBUG("Got filename: %s\n", filename);
+	if (flags & FLAG_HELP)
+		showusage(false);
 
-		flags |= FLAG_DEVICE;
-		device = argv[optind + 1];
-		DEBUG("Got device: %s\n", device);
+	if (!json)
+		progress_fd = -1;
+	else if (progress_fd < 0)
+		progress_fd = STDERR_FILENO;
 
-		offset = strtoul(argv[optind + 2], NULL, 16);
-		DEBUG("Got offset: %s\n", offset);
+	/* -d <file> <device>: back the device up instead of writing it */
+	if (flags & FLAG_DUMP) {
+		if (optind + 1 != argc || flags & (FLAG_TARGETS | FLAG_MANIFEST |
+				FLAG_GEN_MANIFEST | FLAG_ERASE_ALL | FLAG_PLAN))
+			showusage(true);
+		atexit(cleanup);
+		t = &targets[target_count++];
+		t->fil_fd = -1;
+		t->flash.fd = -1;
+		t->filename = dump_path;
+		t->device = argv[optind];
+		flash_target_open_device(t);
+		if (progress_fd >= 0)
+			mtd_flash_set_progress(&t->flash, flash_progress_json_cb,
+					&t->progress);
+		else if (flags & FLAG_VERBOSE)
+			mtd_flash_set_progress(&t->flash, flash_progress, &t->progress);
+		t->result = flash_dump(t);
+		record_rates(t);
+		flash_progress_json_result(&t->progress, t->device, target_result(t),
+				t->elapsed_us);
+		exit(t->result);
 	}
 
-	if (optind + 2 == argc) {
-		flags |= FLAG_FILENAME;
-		filename = argv[optind];
-		DEBUG("Got filename: %s\n", filename);
-
-		flags |= FLAG_DEVICE;
-		device = argv[optind + 1];
-		DEBUG("Got device: %s\n", device);
-
-		offset = 0;
+	/* The positional arguments are a target like any other */
+	if (optind + 1 <= argc && optind + 3 >= argc) {
+		if (target_count == MAX_TARGETS) {
+			log_printf(LOG_ERROR, "At most %d targets are supported\n",
+					MAX_TARGETS);
+			exit(EXIT_FAILURE);
+		}
+		memmove(&targets[1], &targets[0], target_count * sizeof(*targets));
+		target_count++;
+		t = &targets[0];
+		memset(t, 0, sizeof(*t));
+		t->fil_fd = -1;
+		t->flash.fd = -1;
+		t->filename = argv[optind];
+		DEBUG("Got filename: %s\n", t->filename);
+		if (optind + 1 < argc) {
+			flags |= FLAG_FILENAME | FLAG_DEVICE;
+			t->device = argv[optind + 1];
+			DEBUG("Got device: %s\n", t->device);
+		}
+		if (optind + 2 < argc) {
+			t->offset = strtoul(argv[optind + 2], NULL, 16);
+			DEBUG("Got offset: %llx\n", (unsigned long long) t->offset);
+		}
+		t->manifest = manifest_path;
+	} else if (optind != argc) {
+		showusage(true);
 	}
 
-	if (flags & FLAG_HELP || device == NULL)
-		showusage(flags != FLAG_HELP);
+	if (target_count == 0 || (targets[0].device == NULL &&
+			!(flags & FLAG_GEN_MANIFEST)))
+		showusage(true);
 
-	atexit(cleanup);
-
-	/* get some info about the flash device */
-	dev_fd = safe_open(device, O_SYNC | O_RDWR);
-	if (ioctl(dev_fd, MEMGETINFO, &mtd) < 0) {
-		DEBUG("ioctl(): %m\n");
+	if (flags & FLAG_PLAN && flags & FLAG_GEN_MANIFEST) {
+		log_printf(LOG_ERROR, "--plan only applies to writing images\n");
+		showusage(true);
+	}
+	if (flags & FLAG_MANIFEST && flags & FLAG_GEN_MANIFEST) {
+		log_printf(LOG_ERROR, "-m and -g can't be used together\n");
+		showusage(true);
+	}
+	if (flags & FLAG_TARGETS && flags & (FLAG_MANIFEST | FLAG_GEN_MANIFEST)) {
 		log_printf(LOG_ERROR,
-				"This doesn't seem to be a valid MTD flash device!\n");
-		exit(EXIT_FAILURE);
+				"Give the manifest of each -t target in its fourth field\n");
+		showusage(true);
 	}
 
-	/* get some info about the file we want to copy */
-	fil_fd = safe_open(filename, O_RDONLY);
-	if (fstat(fil_fd, &filestat) < 0) {
-		log_printf(LOG_ERROR, "While trying to get the file status of %s: %m\n",
-				filename);
-		exit(EXIT_FAILURE);
-	}
+	atexit(cleanup);
 
-	/* does it fit into the device/partition? */
-	if (filestat.st_size > mtd.size) {
-		log_printf(LOG_ERROR, "%s won't fit into %s!\n", filename, device);
-		exit(EXIT_FAILURE);
+	t = &targets[0];
+	if (flags & FLAG_GEN_MANIFEST) {
+		if (t->device)
+			flash_target_open(t);
+		else {
+			t->fil_fd = safe_open(t->filename, O_RDONLY);
+			if (fstat(t->fil_fd, &t->filestat) < 0) {
+				log_printf(LOG_ERROR,
+						"While trying to get the file status of %s: %m\n",
+						t->filename);
+				exit(EXIT_FAILURE);
+			}
+		}
+		exit(gen_manifest(t));
 	}
 
-	/* does offset is out of the mtd */
-	if (offset > mtd.size) {
-		log_printf(LOG_ERROR, "%s offset won't fit into %s!\n", offset, device);
-		exit(EXIT_FAILURE);
-	}
+	for (i = 0; i < target_count; i++)
+		flash_target_open(&targets[i]);
 
-	/* Erase flash partition based on the input file size */
-	if (flash_erase(dev_fd, offset, device) != EXIT_SUCCESS)
-		exit(EXIT_FAILURE);
+	if (flags & FLAG_PLAN) {
+		uint64_t longest = 0;
+		bool unknown = false;
 
-	/* Write the entire file to flash */
-	if (flash_write(dev_fd, fil_fd, offset, device, filename) != EXIT_SUCCESS)
-		exit(EXIT_FAILURE);
+		for (i = 0; i < target_count; i++) {
+			t = &targets[i];
+			if (flash_plan(t) != EXIT_SUCCESS)
+				exit(EXIT_FAILURE);
+			unknown |= !t->plan_us;
+			if (t->plan_us > longest)
+				longest = t->plan_us;
+		}
+		if (target_count > 1 && !unknown)
+			log_printf(LOG_NORMAL,
+					"Estimated %llu.%03llus with the devices flashed concurrently\n",
+					(unsigned long long) (longest / 1000000),
+					(unsigned long long) (longest / 1000 % 1000));
+		exit(EXIT_SUCCESS);
+	}
 
-	/* Verify that flash == file data */
-	if (flash_verify(dev_fd, fil_fd, offset, device, filename) != EXIT_SUCCESS)
+	if (target_count > 1)
+		exit(flash_targets());
+
+	if (progress_fd >= 0)
+		mtd_flash_set_progress(&t->flash, flash_progress_json_cb, &t->progress);
+	else if (flags & FLAG_VERBOSE)
+		mtd_flash_set_progress(&t->flash, flash_progress, &t->progress);
+	flash_target_thread(t);
+	record_rates(t);
+	flash_progress_json_result(&t->progress, t->device, target_result(t),
+			t->elapsed_us);
+	if (t->result != EXIT_SUCCESS)
 		exit(EXIT_FAILURE);
 
-	log_printf(LOG_NORMAL,"done");
+	if (!t->up_to_date)
+		log_printf(LOG_NORMAL,"done");
 	exit(EXIT_SUCCESS);
 }
@@ -16,6 +16,7 @@
 * This program is for updating FRU EEPROM device
 */
 
+#include <errno.h>
 #include <fcntl.h>
 #include <linux/errno.h>
 #include <linux/i2c-dev.h>
@@ -25,20 +26,52 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 #include <zlib.h>
 
 #pragma pack(1)
 
+/* The image is copied in chunks of this size */
+#define FRU_CHUNK_SIZE 256
+/* Granularity of the diff mode writes, the smallest common AT24 page */
+#define FRU_DEFAULT_PAGE_SIZE 8
+
+/*
+ * Parsed FRU cache for the BMC services that would otherwise re-read and
+ * re-parse the EEPROM over I2C. One file per device, named after the device
+ * path, holding "key=value" lines:
+ *	version=1
+ *	hash=crc32:<CRC32 of the FRU image>
+ *	size=<image size>
+ *	common.checksum=ok|bad
+ *	<area>.present=0|1, <area>.checksum=ok|bad, <area>.<field>=<value>
+ *	multirecord.count=<n>, multirecord.<i>.type/length/checksum
+ * <area> is chassis, board or product. Non printable bytes of a value are
+ * escaped as \xNN. The cache is removed before the device is written and
+ * recreated once the new image has been verified.
+ */
+#define FRU_CACHE_DIR "/run/ampere-fru"
+#define FRU_CACHE_VERSION 1
+#define FRU_AREA_MAX_SIZE (255 * 8)
+#define FRU_END_OF_FIELDS 0xC1
+/* Minutes between the Unix epoch and the FRU epoch 1996-01-01 */
+#define FRU_EPOCH_MINUTES (820454400 / 60)
+
 static char fru_device[128] = "";
 static char fru_image[128] = "";
+static int diff_mode;
+static int page_size = FRU_DEFAULT_PAGE_SIZE;
 
 static void display_usage(void) {
 	printf("Usage: ampere_fru_upgrade <args>\n");
 	printf("Arguments:\n");
 	printf("\t-d <dev> \t: FRU sysfs device\n");
 	printf("\t-f <file>\t: The FRU file\n");
+	printf("\t-u\t\t: only write the pages that differ from the device\n");
+	printf("\t-p <size>\t: EEPROM page size for -u and verify (default %d)\n",
+	       FRU_DEFAULT_PAGE_SIZE);
 }
 
 static int image_arg_handler(int argc, char **argv, int index) {
@@ -53,11 +86,29 @@ static int device_arg_handler(int argc, char **argv, int index) {
 	return 0;
 }
 
-static char *arglist[] = {"-d", "-f", NULL};
+static int diff_arg_handler(int argc, char **argv, int index) {
+	diff_mode = 1;
+	return 0;
+}
+
+static int page_arg_handler(int argc, char **argv, int index) {
+	if (index + 1 >= argc)
+		return -EINVAL;
+	page_size = (int)strtol(argv[index + 1], NULL, 0);
+	/* Pages must tile the copy chunk */
+	if (page_size <= 0 || page_size > FRU_CHUNK_SIZE ||
+	    FRU_CHUNK_SIZE % page_size)
+		return -EINVAL;
+	return 0;
+}
+
+static char *arglist[] = {"-d", "-f", "-u", "-p", NULL};
 
 static int (*handlerlist[])(int, char **, int) = {
 	device_arg_handler,
 	image_arg_handler,
+	diff_arg_handler,
+	page_arg_handler,
 	NULL
 };
 
@@ -86,48 +137,314 @@ arg_list_loop:
 	return 0;
 }
 
-static int verify_valid_image(uint32_t crc32_checksum, ssize_t sz) {
-	FILE *fru_device_file;
-	char *buf;
-	uint32_t checksum;
-	int ret = 0;
+static char *fru_cache_path(char *path, size_t len) {
+	char *p;
 
-	/* Read FW file to buffer */
-	fru_device_file = fopen(fru_device, "rb");
-	if (!fru_device_file) {
-		printf("Can't open file for reading\n");
-		return -EINVAL;
+	snprintf(path, len, FRU_CACHE_DIR "/%s", fru_device);
+	for (p = path + strlen(FRU_CACHE_DIR) + 1; *p; p++)
+		if (!((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') ||
+		      (*p >= '0' && *p <= '9') || *p == '-' || *p == '.'))
+			*p = '_';
+
+	return path;
+}
+
+static int fru_read(FILE *fp, long off, unsigned char *buf, size_t len) {
+	if (fseek(fp, off, SEEK_SET) || fread(buf, len, 1, fp) != 1)
+		return -EIO;
+	return 0;
+}
+
+static unsigned char fru_sum(const unsigned char *buf, size_t len) {
+	unsigned char sum = 0;
+
+	while (len--)
+		sum += *buf++;
+	return sum;
+}
+
+static int fru_checksum_ok(const unsigned char *buf, size_t len) {
+	return fru_sum(buf, len) == 0;
+}
+
+static void fru_put_char(FILE *out, unsigned char c) {
+	if (c >= 0x20 && c < 0x7F && c != '\\')
+		fputc(c, out);
+	else
+		fprintf(out, "\\x%02x", c);
+}
+
+/* Decode a type/length encoded field according to its type bits */
+static void fru_put_field(FILE *out, const unsigned char *data, int len,
+			  int type) {
+	static const char bcd_plus[] = "0123456789 -.???";
+	uint32_t bits;
+	int i, j;
+
+	switch (type) {
+	case 0: /* Binary */
+		for (i = 0; i < len; i++)
+			fprintf(out, "%02x", data[i]);
+		break;
+	case 1: /* BCD plus */
+		for (i = 0; i < len; i++) {
+			fputc(bcd_plus[data[i] >> 4], out);
+			fputc(bcd_plus[data[i] & 0xF], out);
+		}
+		break;
+	case 2: /* 6-bit packed ASCII, 4 characters in 3 bytes */
+		for (i = 0; i < len; i += 3) {
+			bits = 0;
+			for (j = 0; j < 3 && i + j < len; j++)
+				bits |= data[i + j] << (8 * j);
+			for (j = 0; j < 4 && (i * 8 + j * 6) < len * 8; j++)
+				fru_put_char(out, ((bits >> (6 * j)) & 0x3F) + 0x20);
+		}
+		break;
+	default: /* 8-bit ASCII + Latin 1 */
+		for (i = 0; i < len; i++)
+			fru_put_char(out, data[i]);
+		break;
+	}
+}
+
+/* Emit the type/length fields of an area starting at pos */
+static void fru_put_fields(FILE *out, const char *area,
+			   const char *const *names, int nnames,
+			   const unsigned char *buf, int pos, int len) {
+	int i, flen;
+
+	for (i = 0; pos < len && buf[pos] != FRU_END_OF_FIELDS; i++) {
+		flen = buf[pos] & 0x3F;
+		if (pos + 1 + flen > len)
+			break;
+		if (i < nnames)
+			fprintf(out, "%s.%s=", area, names[i]);
+		else
+			fprintf(out, "%s.custom%d=", area, i - nnames);
+		fru_put_field(out, buf + pos + 1, flen, buf[pos] >> 6);
+		fputc('\n', out);
+		pos += 1 + flen;
+	}
+}
+
+static void fru_put_area(FILE *out, FILE *fp, ssize_t sz, const char *area,
+			 unsigned char offset) {
+	static const char *const chassis[] = {"part_number", "serial_number"};
+	static const char *const board[] = {"manufacturer", "product_name",
+					    "serial_number", "part_number",
+					    "fru_file_id"};
+	static const char *const product[] = {"manufacturer", "product_name",
+					      "part_number", "version",
+					      "serial_number", "asset_tag",
+					      "fru_file_id"};
+	unsigned char buf[FRU_AREA_MAX_SIZE];
+	long off = offset * 8;
+	int len;
+
+	fprintf(out, "%s.present=%d\n", area, offset != 0);
+	if (!offset)
+		return;
+	if (off + 2 > sz || fru_read(fp, off, buf, 2) || !buf[1] ||
+	    off + buf[1] * 8 > sz) {
+		fprintf(out, "%s.checksum=bad\n", area);
+		return;
+	}
+	len = buf[1] * 8;
+	if (fru_read(fp, off, buf, len) || !fru_checksum_ok(buf, len)) {
+		fprintf(out, "%s.checksum=bad\n", area);
+		return;
+	}
+	fprintf(out, "%s.checksum=ok\n", area);
+
+	if (!strcmp(area, "chassis")) {
+		fprintf(out, "chassis.type=%u\n", buf[2]);
+		fru_put_fields(out, area, chassis, 2, buf, 3, len);
+	} else if (!strcmp(area, "board")) {
+		fprintf(out, "board.mfg_date=%u\n",
+			(unsigned)(((buf[3] | buf[4] << 8 | buf[5] << 16) +
+				    FRU_EPOCH_MINUTES) * 60));
+		fru_put_fields(out, area, board, 5, buf, 6, len);
+	} else {
+		fru_put_fields(out, area, product, 7, buf, 3, len);
+	}
+}
+
+static void fru_put_multirecord(FILE *out, FILE *fp, ssize_t sz,
+				unsigned char offset) {
+	unsigned char hdr[5];
+	unsigned char data[255];
+	long off = offset * 8;
+	int n = 0;
+
+	while (offset && off + 5 <= sz && !fru_read(fp, off, hdr, 5)) {
+		fprintf(out, "multirecord.%d.type=0x%02x\n", n, hdr[0]);
+		fprintf(out, "multirecord.%d.length=%u\n", n, hdr[2]);
+		if (!fru_checksum_ok(hdr, 5) || off + 5 + hdr[2] > sz ||
+		    fru_read(fp, off + 5, data, hdr[2]) ||
+		    (unsigned char)(hdr[3] + fru_sum(data, hdr[2])) != 0) {
+			fprintf(out, "multirecord.%d.checksum=bad\n", n++);
+			break;
+		}
+		fprintf(out, "multirecord.%d.checksum=ok\n", n++);
+		/* End of list */
+		if (hdr[1] & 0x80)
+			break;
+		off += 5 + hdr[2];
 	}
-	fseek(fru_device_file, 0, SEEK_END);
-	buf = malloc(sz);
-	if (!buf) {
-		printf("Not enough memory\n");
-		fclose(fru_device_file);
+	fprintf(out, "multirecord.count=%d\n", n);
+}
+
+/*
+ * Parse the FRU image into the cache file of the device, written to a
+ * temporary file first and renamed so readers never see a partial cache.
+ */
+static int fru_cache_write(FILE *fp, ssize_t sz, uint32_t checksum) {
+	char path[sizeof(FRU_CACHE_DIR) + sizeof(fru_device) + 1];
+	char tmp[sizeof(path) + 8];
+	unsigned char hdr[8];
+	FILE *out;
+	int fd;
+
+	if (mkdir(FRU_CACHE_DIR, 0755) && errno != EEXIST)
+		return -errno;
+	fru_cache_path(path, sizeof(path));
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		return -errno;
+	fchmod(fd, 0644);
+	out = fdopen(fd, "w");
+	if (!out) {
+		close(fd);
+		unlink(tmp);
 		return -ENOMEM;
 	}
-	fseek(fru_device_file, 0, SEEK_SET);
-	fread(buf, sz, 1, fru_device_file);
 
-	/* Get checksum of input data */
-	checksum = crc32(0, (unsigned char *)buf, sz);
+	fprintf(out, "version=%d\n", FRU_CACHE_VERSION);
+	fprintf(out, "hash=crc32:%08x\n", checksum);
+	fprintf(out, "size=%ld\n", (long)sz);
+	if (sz < 8 || fru_read(fp, 0, hdr, 8) || hdr[0] != 1 ||
+	    !fru_checksum_ok(hdr, 8)) {
+		fprintf(out, "common.checksum=bad\n");
+	} else {
+		fprintf(out, "common.checksum=ok\n");
+		fru_put_area(out, fp, sz, "chassis", hdr[2]);
+		fru_put_area(out, fp, sz, "board", hdr[3]);
+		fru_put_area(out, fp, sz, "product", hdr[4]);
+		fru_put_multirecord(out, fp, sz, hdr[5]);
+	}
+
+	if (fclose(out) || rename(tmp, path)) {
+		unlink(tmp);
+		return -EIO;
+	}
+
+	return 0;
+}
 
-	if (checksum != crc32_checksum) {
+static uint64_t now_us(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/*
+ * Read the device back one page at a time through a fresh descriptor with
+ * pread, comparing it against the image as it goes and stopping at the first
+ * mismatch, then check the CRC32 of the device contents.
+ */
+static int verify_valid_image(FILE *fru_image_file, uint32_t crc32_checksum,
+			      ssize_t sz) {
+	unsigned char img[FRU_CHUNK_SIZE];
+	unsigned char dev[FRU_CHUNK_SIZE];
+	uint32_t checksum = crc32(0, NULL, 0);
+	ssize_t off, bytes;
+	uint64_t start, elapsed;
+	int fd, ret = 0;
+
+	fd = open(fru_device, O_RDONLY);
+	if (fd < 0) {
+		printf("Can't open file for reading\n");
+		return -EINVAL;
+	}
+	/*
+	 * The sysfs eeprom attribute is not page cached, each pread goes to the
+	 * at24 driver and reads the device
+	 */
+	rewind(fru_image_file);
+
+	start = now_us();
+	for (off = 0; off < sz; off += bytes) {
+		bytes = sz - off >= page_size ? page_size : sz - off;
+		if (fread(img, bytes, 1, fru_image_file) != 1 ||
+		    pread(fd, dev, bytes, off) != bytes) {
+			ret = -EIO;
+			break;
+		}
+		if (memcmp(img, dev, bytes)) {
+			printf("Mismatch data at offset 0x%lx!\n", (unsigned long)off);
+			ret = -EIO;
+			break;
+		}
+		checksum = crc32(checksum, dev, bytes);
+	}
+	elapsed = now_us() - start;
+	close(fd);
+
+	/* Get checksum of the device data */
+	if (!ret && checksum != crc32_checksum) {
 		printf("Mismatch data!");
 		ret = -EIO;
 	}
-
-	fclose(fru_device_file);
+	if (!ret)
+		printf("Verified %ld bytes in %llu ms (%llu B/s)\n", (long)sz,
+		       (unsigned long long)(elapsed / 1000),
+		       (unsigned long long)(elapsed ? sz * 1000000 / elapsed : 0));
 
 	return ret;
 }
 
+/*
+ * Write the pages of buf that differ from the device contents in cur,
+ * merging adjacent pages into one write. Returns the bytes written.
+ */
+static ssize_t write_changed_pages(int fd, off_t off, unsigned char *buf,
+				   unsigned char *cur, ssize_t bytes) {
+	ssize_t start = -1, pg, n, written = 0;
+
+	for (pg = 0; pg <= bytes; pg += page_size) {
+		n = bytes - pg >= page_size ? page_size : bytes - pg;
+		if (pg < bytes && memcmp(buf + pg, cur + pg, n)) {
+			if (start < 0)
+				start = pg;
+			continue;
+		}
+		if (start < 0)
+			continue;
+		/* End of a run of changed pages */
+		if (pwrite(fd, buf + start, pg - start, off + start) !=
+		    pg - start)
+			return -EIO;
+		written += pg - start;
+		start = -1;
+	}
+
+	return written;
+}
+
 int main(int argc, char **argv) {
 	FILE *fru_image_file;
-	FILE *fru_device_file;
-	int ret;
-	ssize_t sz;
-	char *buf;
-	uint32_t crc32_checksum;
+	int fru_device_fd;
+	int ret = 0;
+	ssize_t sz, off, bytes, n, written = 0;
+	unsigned char buf[FRU_CHUNK_SIZE];
+	unsigned char cur[FRU_CHUNK_SIZE];
+	uint32_t crc32_checksum = crc32(0, NULL, 0);
+	char cache_path[sizeof(FRU_CACHE_DIR) + sizeof(fru_device) + 1];
+	uint64_t start, elapsed, t, wr_us = 0;
+	int64_t saved;
 
 	/* Parsing the arguments */
 	ret = parse_arguments(argc, argv);
@@ -137,7 +454,6 @@ int main(int argc, char **argv) {
 		return -EOPNOTSUPP;
 	}
 
-	/* Read FW file to buffer */
 	fru_image_file = fopen(fru_image, "rb");
 	if (!fru_image_file) {
 		printf("Can't open file for reading\n");
@@ -145,53 +461,73 @@ int main(int argc, char **argv) {
 	}
 	fseek(fru_image_file, 0, SEEK_END);
 	sz = ftell(fru_image_file);
-	buf = malloc(sz);
-	if (!buf) {
-		printf("Not enough memory\n");
-		fclose(fru_image_file);
-		return -ENOMEM;
-	}
-	fseek(fru_image_file, 0, SEEK_SET);
-	fread(buf, sz, 1, fru_image_file);
+	rewind(fru_image_file);
 
-	/* Get checksum of input data */
-	crc32_checksum = crc32(0, (unsigned char *)buf, sz);
+	/* The cache describes the old contents from now on */
+	unlink(fru_cache_path(cache_path, sizeof(cache_path)));
 
 	/* Write into FRU device */
-	fru_device_file = fopen(fru_device, "rb+");
-	if (!fru_device_file) {
+	fru_device_fd = open(fru_device, O_RDWR);
+	if (fru_device_fd < 0) {
 		printf("Can't open device for upgrading\n");
 		fclose(fru_image_file);
 		return -EINVAL;
 	}
-	if (fseek(fru_device_file, 0, SEEK_END)) {
-		/* Error when accessing file */
-		/* Close files and skip checksum */
-		crc32_checksum = 0;
-		ret = -EIO;
-		goto closefiles;
-	}
-	rewind(fru_device_file);
-	if (fwrite(buf, sz, 1, fru_device_file) != 1) {
-		/* Error when accessing file */
-		/* Close files and skip checksum */
-		crc32_checksum = 0;
-		ret = -EIO;
-		goto closefiles;
+
+	/* Stream the image, computing its checksum along the way */
+	start = now_us();
+	for (off = 0; off < sz; off += bytes) {
+		bytes = sz - off >= FRU_CHUNK_SIZE ? FRU_CHUNK_SIZE : sz - off;
+		if (fread(buf, bytes, 1, fru_image_file) != 1) {
+			ret = -EIO;
+			break;
+		}
+		crc32_checksum = crc32(crc32_checksum, buf, bytes);
+		if (diff_mode) {
+			if (pread(fru_device_fd, cur, bytes, off) != bytes) {
+				ret = -EIO;
+				break;
+			}
+			t = now_us();
+			n = write_changed_pages(fru_device_fd, off, buf, cur, bytes);
+			wr_us += now_us() - t;
+		} else {
+			n = pwrite(fru_device_fd, buf, bytes, off) == bytes ? bytes :
+									    -EIO;
+		}
+		if (n < 0) {
+			/* Error when accessing file */
+			/* Close files and skip checksum */
+			ret = -EIO;
+			break;
+		}
+		written += n;
 	}
 
-	fflush(fru_device_file);
-	fsync(fileno(fru_device_file));
+	fsync(fru_device_fd);
+	close(fru_device_fd);
+	elapsed = now_us() - start;
 
-closefiles:
-	free(buf);
-	fclose(fru_image_file);
-	fclose(fru_device_file);
+	if (!ret && diff_mode) {
+		printf("Wrote %ld of %ld bytes in %llu ms", (long)written,
+		       (long)sz, (unsigned long long)(elapsed / 1000));
+		/* Extrapolate the write rate to a full image write */
+		if (written) {
+			saved = (int64_t)(sz * wr_us / written) - (int64_t)elapsed;
+			printf(", about %lld ms saved over a full write",
+			       (long long)(saved / 1000));
+		}
+		printf("\n");
+	}
 
 	/* Verify the image by checking the checksum */
-	if (crc32_checksum != 0) {
-		ret = verify_valid_image(crc32_checksum, sz);
-	}
+	if (!ret)
+		ret = verify_valid_image(fru_image_file, crc32_checksum, sz);
+
+	if (!ret && fru_cache_write(fru_image_file, sz, crc32_checksum))
+		printf("Warning: can't write the FRU cache %s\n", cache_path);
+
+	fclose(fru_image_file);
 
 	return ret;
 }
@@ -0,0 +1,74 @@
+#!/bin/sh
+#
+# Copyright (c) 2021 Ampere Computing LLC
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#	http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# Benchmark ampere_eeprom_prog against the at24_emu EEPROM emulator.
+# Programs a random image into a blank device, reprograms it in diff mode
+# after changing a few pages, and reports the time and throughput of each.
+#
+# Usage: at24_bench.sh [image size in bytes] [EEPROM type]
+#
+# The emulator settings (AT24_EMU_WRITE_US, AT24_EMU_BUS_HZ, AT24_EMU_FLIP)
+# are taken from the environment.
+
+set -e
+
+SIZE=${1:-262144}
+TYPE=${2:-4}
+CC=${CC:-cc}
+HERE=$(cd "$(dirname "$0")" && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+$CC -O2 -shared -fPIC -o "$WORK/at24_emu.so" "$HERE/at24_emu.c" -ldl
+$CC -O2 -o "$WORK/ampere_eeprom_prog" "$HERE/../ampere_eeprom_prog.c" -lz -pthread
+
+head -c "$SIZE" /dev/urandom > "$WORK/image.bin"
+
+export AT24_EMU_TYPE=$TYPE
+export AT24_EMU_IMAGE="$WORK/device.bin"
+
+now_ms() {
+	echo $(($(date +%s%N) / 1000000))
+}
+
+run() {
+	name=$1
+	shift
+	start=$(now_ms)
+	if ! LD_PRELOAD="$WORK/at24_emu.so" "$WORK/ampere_eeprom_prog" \
+		-b 1 -s 0x50 -t "$TYPE" "$@" -f "$WORK/image.bin" \
+		> "$WORK/$name.log" 2>&1; then
+		cat "$WORK/$name.log"
+		echo "$name: FAILED"
+		exit 1
+	fi
+	ms=$(($(now_ms) - start))
+	[ "$ms" -gt 0 ] || ms=1
+	grep "at24_emu:" "$WORK/$name.log"
+	echo "$name: $SIZE bytes in ${ms}ms ($((SIZE * 1000 / ms)) B/s)"
+}
+
+run full -p
+
+# Change a byte in three pages spread over the image
+for off in 0 $((SIZE / 2)) $((SIZE - 1)); do
+	printf '\125' | dd of="$WORK/image.bin" bs=1 seek="$off" conv=notrunc \
+		2> /dev/null
+done
+run diff -u
+
+cmp -n "$SIZE" "$WORK/image.bin" "$WORK/device.bin"
+echo "device contents match the image"
@@ -0,0 +1,407 @@
+/*
+ * Copyright (c) 2021 Ampere Computing LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * LD_PRELOAD shim emulating an Atmel AT24 EEPROM behind /dev/i2c-N, so that
+ * ampere_eeprom_prog can be run and benchmarked without hardware.
+ *
+ * Build:
+ *	cc -O2 -shared -fPIC -o at24_emu.so at24_emu.c -ldl
+ * Run:
+ *	LD_PRELOAD=./at24_emu.so ampere_eeprom_prog -b 1 -s 0x50 -t 4 -p -f img
+ *
+ * The emulated device is configured through the environment:
+ *	AT24_EMU_TYPE      EEPROM type as for ampere_eeprom_prog -t (default 4)
+ *	AT24_EMU_SIZE      Device size in bytes (default 256KB)
+ *	AT24_EMU_ADDR      First I2C slave address (default 0x50)
+ *	AT24_EMU_WRITE_US  Page write cycle time in us (default 5000)
+ *	AT24_EMU_BUS_HZ    I2C bus clock used to model transfer time
+ *	                   (default 400000, 0 disables)
+ *	AT24_EMU_IMAGE     Backing file loaded at start and saved at exit
+ *	AT24_EMU_FLIP      Corrupt one in every N page writes (default 0, off)
+ *
+ * Each 64KB bank answers on its own slave address starting from
+ * AT24_EMU_ADDR, writes wrap within their page, sequential reads wrap at
+ * the end of the bank, and the device NACKs while a write cycle is in
+ * progress. Transfer counters are printed on stderr at exit.
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#define AT24_BANK_SIZE   0x10000
+#define AT24_MAX_BANKS   4
+#define AT24_I2C_PREFIX  "/dev/i2c-"
+
+struct at24_emu
+{
+	int fd;
+	uint8_t base_addr;
+	uint8_t slave;
+	uint32_t size;
+	uint32_t pagesize;
+	uint32_t addr_len;
+	uint32_t write_us;
+	uint32_t bus_hz;
+	uint32_t flip;
+	const char *image;
+	uint8_t *mem;
+	/* Address counter of each bank */
+	uint32_t ptr[AT24_MAX_BANKS];
+	struct timespec busy_until;
+	/* Counters */
+	uint64_t xfers;
+	uint64_t nacks;
+	uint64_t page_writes;
+	uint64_t bytes_rd;
+	uint64_t bytes_wr;
+	uint64_t bus_us;
+	struct timespec start;
+};
+
+static struct at24_emu emu = { .fd = -1 };
+
+static int (*real_open)(const char *, int, ...);
+static int (*real_close)(int);
+static int (*real_ioctl)(int, unsigned long, ...);
+static ssize_t (*real_write)(int, const void *, size_t);
+
+static uint32_t env_u32(const char *name, uint32_t def)
+{
+	const char *val = getenv(name);
+
+	return val ? (uint32_t)strtoul(val, NULL, 0) : def;
+}
+
+static uint64_t ts_us(const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * 1000000 + ts->tv_nsec / 1000;
+}
+
+static uint64_t now_us(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ts_us(&now);
+}
+
+__attribute__((constructor)) static void at24_emu_init(void)
+{
+	FILE *fp;
+
+	real_open = dlsym(RTLD_NEXT, "open");
+	real_close = dlsym(RTLD_NEXT, "close");
+	real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+	real_write = dlsym(RTLD_NEXT, "write");
+
+	switch (env_u32("AT24_EMU_TYPE", 4))
+	{
+	case 1:
+		emu.pagesize = 0x8;
+		break;
+	case 2:
+		emu.pagesize = 0x20;
+		break;
+	case 3:
+		emu.pagesize = 0x80;
+		break;
+	default:
+		emu.pagesize = 0x100;
+		break;
+	}
+	emu.addr_len = emu.pagesize == 0x8 ? 1 : 2;
+	emu.size = env_u32("AT24_EMU_SIZE", AT24_MAX_BANKS * AT24_BANK_SIZE);
+	if (emu.size > AT24_MAX_BANKS * AT24_BANK_SIZE)
+		emu.size = AT24_MAX_BANKS * AT24_BANK_SIZE;
+	emu.base_addr = env_u32("AT24_EMU_ADDR", 0x50);
+	emu.write_us = env_u32("AT24_EMU_WRITE_US", 5000);
+	emu.bus_hz = env_u32("AT24_EMU_BUS_HZ", 400000);
+	emu.flip = env_u32("AT24_EMU_FLIP", 0);
+	emu.image = getenv("AT24_EMU_IMAGE");
+
+	emu.mem = malloc(emu.size);
+	if (!emu.mem)
+		abort();
+	memset(emu.mem, 0xFF, emu.size);
+	if (emu.image)
+	{
+		fp = fopen(emu.image, "rb");
+		if (fp)
+		{
+			if (fread(emu.mem, 1, emu.size, fp) == 0)
+				memset(emu.mem, 0xFF, emu.size);
+			fclose(fp);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &emu.start);
+}
+
+__attribute__((destructor)) static void at24_emu_exit(void)
+{
+	uint64_t elapsed = now_us() - ts_us(&emu.start);
+	FILE *fp;
+
+	if (emu.image)
+	{
+		fp = fopen(emu.image, "wb");
+		if (fp)
+		{
+			fwrite(emu.mem, 1, emu.size, fp);
+			fclose(fp);
+		}
+	}
+	fprintf(stderr,
+			"at24_emu: %llu xfers, %llu NACKs, %llu page writes, "
+			"%llu bytes written, %llu bytes read, %llu us on the bus, "
+			"%llu us total\n",
+			(unsigned long long)emu.xfers, (unsigned long long)emu.nacks,
+			(unsigned long long)emu.page_writes,
+			(unsigned long long)emu.bytes_wr,
+			(unsigned long long)emu.bytes_rd,
+			(unsigned long long)emu.bus_us, (unsigned long long)elapsed);
+	if (elapsed && emu.bytes_wr)
+		fprintf(stderr, "at24_emu: write throughput %llu B/s\n",
+				(unsigned long long)(emu.bytes_wr * 1000000 / elapsed));
+	free(emu.mem);
+}
+
+/* Model the time the transfer takes on the wire, 9 clocks per byte */
+static void bus_delay(uint32_t bytes)
+{
+	uint64_t us;
+
+	if (!emu.bus_hz)
+		return;
+	us = (uint64_t)bytes * 9 * 1000000 / emu.bus_hz;
+	emu.bus_us += us;
+	usleep(us);
+}
+
+/* Return the bank of slave, or -1 when the slave would not ACK */
+static int at24_select(uint8_t slave)
+{
+	struct timespec now;
+	int bank = slave - emu.base_addr;
+
+	if (bank < 0 || bank >= AT24_MAX_BANKS ||
+		(uint32_t)bank * AT24_BANK_SIZE >= emu.size)
+		return -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (ts_us(&now) < ts_us(&emu.busy_until))
+	{
+		emu.nacks++;
+		return -1;
+	}
+
+	return bank;
+}
+
+/* Span addressed by a bank, where its address counter rolls over */
+static uint32_t bank_size(int bank)
+{
+	uint32_t size = emu.addr_len == 1 ? 0x100 : AT24_BANK_SIZE;
+
+	if (emu.size - bank * AT24_BANK_SIZE < size)
+		size = emu.size - bank * AT24_BANK_SIZE;
+	return size;
+}
+
+/* Handle a write message: address bytes, then optional page data */
+static int at24_write(uint8_t slave, const uint8_t *buf, uint32_t len)
+{
+	uint32_t addr, page, i;
+	uint8_t *mem;
+	int bank;
+
+	bank = at24_select(slave);
+	if (bank < 0)
+	{
+		bus_delay(1);
+		return -1;
+	}
+	bus_delay(len + 1);
+	if (len < emu.addr_len)
+		return 0;
+
+	addr = emu.addr_len == 1 ? buf[0] : (buf[0] << 8) | buf[1];
+	addr %= bank_size(bank);
+	emu.ptr[bank] = addr;
+	buf += emu.addr_len;
+	len -= emu.addr_len;
+	if (!len)
+		return 0;
+
+	/* Data wraps around within the page */
+	mem = emu.mem + bank * AT24_BANK_SIZE;
+	page = addr & ~(emu.pagesize - 1);
+	for (i = 0; i < len; i++)
+		mem[page + (addr - page + i) % emu.pagesize] = buf[i];
+	emu.page_writes++;
+	emu.bytes_wr += len;
+	if (emu.flip && emu.page_writes % emu.flip == 0)
+		mem[addr] ^= 0x01;
+
+	clock_gettime(CLOCK_MONOTONIC, &emu.busy_until);
+	emu.busy_until.tv_nsec += (long)emu.write_us * 1000;
+	emu.busy_until.tv_sec += emu.busy_until.tv_nsec / 1000000000;
+	emu.busy_until.tv_nsec %= 1000000000;
+
+	return 0;
+}
+
+/* Handle a read message from the current address counter */
+static int at24_read(uint8_t slave, uint8_t *buf, uint32_t len)
+{
+	uint8_t *mem;
+	uint32_t i;
+	int bank;
+
+	bank = at24_select(slave);
+	if (bank < 0)
+	{
+		bus_delay(1);
+		return -1;
+	}
+	bus_delay(len + 1);
+
+	mem = emu.mem + bank * AT24_BANK_SIZE;
+	for (i = 0; i < len; i++)
+	{
+		buf[i] = mem[emu.ptr[bank]];
+		emu.ptr[bank] = (emu.ptr[bank] + 1) % bank_size(bank);
+	}
+	emu.bytes_rd += len;
+
+	return 0;
+}
+
+static int at24_rdwr(struct i2c_rdwr_ioctl_data *data)
+{
+	uint32_t i;
+	int ret;
+
+	if (data->nmsgs > I2C_RDWR_IOCTL_MAX_MSGS)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	for (i = 0; i < data->nmsgs; i++)
+	{
+		if (data->msgs[i].len > 8192)
+		{
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	emu.xfers++;
+	for (i = 0; i < data->nmsgs; i++)
+	{
+		if (data->msgs[i].flags & I2C_M_RD)
+			ret = at24_read(data->msgs[i].addr, data->msgs[i].buf,
+							data->msgs[i].len);
+		else
+			ret = at24_write(data->msgs[i].addr, data->msgs[i].buf,
+							 data->msgs[i].len);
+		if (ret < 0)
+		{
+			errno = ENXIO;
+			return -1;
+		}
+	}
+
+	return data->nmsgs;
+}
+
+int open(const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+	va_list ap;
+
+	if (flags & O_CREAT)
+	{
+		va_start(ap, flags);
+		mode = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+	if (strncmp(path, AT24_I2C_PREFIX, strlen(AT24_I2C_PREFIX)))
+		return real_open(path, flags, mode);
+
+	emu.fd = real_open("/dev/null", O_RDWR);
+	return emu.fd;
+}
+
+int open64(const char *path, int flags, ...) __attribute__((alias("open")));
+
+int close(int fd)
+{
+	if (fd >= 0 && fd == emu.fd)
+		emu.fd = -1;
+	return real_close(fd);
+}
+
+int ioctl(int fd, unsigned long req, ...)
+{
+	va_list ap;
+	void *arg;
+
+	va_start(ap, req);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	if (fd < 0 || fd != emu.fd)
+		return real_ioctl(fd, req, arg);
+
+	switch (req)
+	{
+	case I2C_SLAVE:
+	case I2C_SLAVE_FORCE:
+		emu.slave = (uint8_t)(unsigned long)arg;
+		return 0;
+	case I2C_RDWR:
+		return at24_rdwr(arg);
+	default:
+		errno = ENOTTY;
+		return -1;
+	}
+}
+
+ssize_t write(int fd, const void *buf, size_t count)
+{
+	if (fd < 0 || fd != emu.fd)
+		return real_write(fd, buf, count);
+
+	emu.xfers++;
+	if (at24_write(emu.slave, buf, count) < 0)
+	{
+		errno = ENXIO;
+		return -1;
+	}
+
+	return count;
+}
@@ -0,0 +1,337 @@
+/*
+ * Copyright (c) 2021 Ampere Computing LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Flash image manifest generation, parsing and device comparison.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "flash_manifest.h"
+
+/* Image bytes hashed per read when generating a manifest */
+#define FLASH_MANIFEST_CHUNK	(1024 * 1024)
+
+/*----------------------------------------------------------------------------
+ * @fn flash_manifest_init
+ *
+ * @brief Prepare an empty manifest to be filled by flash_manifest_update
+ * @params  manifest [OUT] - Manifest, freed with flash_manifest_free
+ * 			size [IN] - Image size in bytes
+ * 			block_size [IN] - Block size, normally the erase block size
+ * @return  0 - Success
+ * 			-errno - Failure
+ *--------------------------------------------------------------------------*/
+int flash_manifest_init(struct flash_manifest *manifest, uint64_t size,
+			uint32_t block_size)
+{
+	memset(manifest, 0, sizeof(*manifest));
+	if (!block_size)
+		return -EINVAL;
+
+	manifest->size = size;
+	manifest->block_size = block_size;
+	manifest->blocks = flash_manifest_blocks(size, block_size);
+	manifest->block_hash = calloc(manifest->blocks ? manifest->blocks : 1,
+				      sizeof(*manifest->block_hash));
+	if (!manifest->block_hash)
+		return -ENOMEM;
+
+	return 0;
+}
+
+/*
+ * Hash count bytes of buf, which start at image offset pos, into the
+ * per-block and whole image hashes.
+ */
+static void flash_manifest_hash(uint32_t *block_hash, uint32_t *hash,
+				uint32_t block_size, uint64_t pos,
+				const uint8_t *buf, size_t count)
+{
+	uint64_t block;
+	size_t len;
+
+	*hash = crc32(*hash, buf, count);
+	while (count) {
+		block = pos / block_size;
+		len = block_size - pos % block_size;
+		if (len > count)
+			len = count;
+		block_hash[block] = crc32(block_hash[block], buf, len);
+		buf += len;
+		pos += len;
+		count -= len;
+	}
+}
+
+/*----------------------------------------------------------------------------
+ * @fn flash_manifest_update
+ *
+ * @brief Hash the next part of the image, given in order
+ * @params  manifest [IN] - Manifest set up by flash_manifest_init
+ * 			pos [IN] - Image offset of buf
+ * 			buf [IN] - Image data
+ * 			count [IN] - Size of buf, pos + count within the image size
+ *--------------------------------------------------------------------------*/
+void flash_manifest_update(struct flash_manifest *manifest, uint64_t pos,
+			   const void *buf, size_t count)
+{
+	flash_manifest_hash(manifest->block_hash, &manifest->hash,
+			    manifest->block_size, pos, buf, count);
+}
+
+/*----------------------------------------------------------------------------
+ * @fn flash_manifest_generate
+ *
+ * @brief Build the manifest of an image file
+ * @params  manifest [OUT] - Manifest to fill, freed with flash_manifest_free
+ * 			fd [IN] - Image file descriptor, read from its start
+ * 			size [IN] - Image size in bytes
+ * 			block_size [IN] - Block size, normally the erase block size
+ * @return  0 - Success
+ * 			-errno - Failure
+ *--------------------------------------------------------------------------*/
+int flash_manifest_generate(struct flash_manifest *manifest, int fd,
+			    uint64_t size, uint32_t block_size)
+{
+	uint8_t *buf;
+	uint64_t done;
+	ssize_t ret;
+	int err;
+
+	err = flash_manifest_init(manifest, size, block_size);
+	if (err < 0)
+		return err;
+
+	buf = malloc(FLASH_MANIFEST_CHUNK);
+	if (!buf) {
+		flash_manifest_free(manifest);
+		return -ENOMEM;
+	}
+
+	for (done = 0; done < size; done += ret) {
+		ret = pread(fd, buf, size - done < FLASH_MANIFEST_CHUNK ?
+				size - done : FLASH_MANIFEST_CHUNK, done);
+		if (ret < 0 && errno == EINTR) {
+			ret = 0;
+			continue;
+		}
+		if (ret <= 0) {
+			err = ret ? -errno : -EIO;
+			free(buf);
+			flash_manifest_free(manifest);
+			return err;
+		}
+		flash_manifest_update(manifest, done, buf, ret);
+	}
+	free(buf);
+
+	return 0;
+}
+
+/*----------------------------------------------------------------------------
+ * @fn flash_manifest_load
+ *
+ * @brief Read a manifest file
+ * @params  manifest [OUT] - Manifest to fill, freed with flash_manifest_free
+ * 			path [IN] - Manifest file
+ * @return  0 - Success
+ * 			-EBADMSG - Malformed or unsupported manifest
+ * 			-errno - Failure
+ *--------------------------------------------------------------------------*/
+int flash_manifest_load(struct flash_manifest *manifest, const char *path)
+{
+	uint64_t size = 0, block, seen = 0;
+	uint32_t block_size = 0, hash = 0, value;
+	int version = 0, has_hash = 0, ret = 0;
+	char line[128];
+	FILE *fp;
+
+	memset(manifest, 0, sizeof(*manifest));
+	fp = fopen(path, "r");
+	if (!fp)
+		return -errno;
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (sscanf(line, "block.%" SCNu64 "=crc32:%" SCNx32, &block,
+			   &value) == 2) {
+			if (!manifest->block_hash) {
+				if (version != FLASH_MANIFEST_VERSION ||
+				    !block_size) {
+					ret = -EBADMSG;
+					break;
+				}
+				ret = flash_manifest_init(manifest, size,
+							   block_size);
+				if (ret < 0)
+					break;
+			}
+			if (block >= manifest->blocks) {
+				ret = -EBADMSG;
+				break;
+			}
+			manifest->block_hash[block] = value;
+			seen++;
+		} else if (sscanf(line, "version=%d", &version) == 1 ||
+			   sscanf(line, "size=%" SCNu64, &size) == 1 ||
+			   sscanf(line, "block=%" SCNu32, &block_size) == 1) {
+			if (manifest->block_hash) {
+				ret = -EBADMSG;
+				break;
+			}
+		} else if (sscanf(line, "hash=crc32:%" SCNx32, &hash) == 1) {
+			has_hash = 1;
+		} else {
+			ret = -EBADMSG;
+			break;
+		}
+	}
+	fclose(fp);
+
+	if (!ret && !manifest->block_hash && size == 0 &&
+	    version == FLASH_MANIFEST_VERSION && block_size)
+		ret = flash_manifest_init(manifest, 0, block_size);
+	if (!ret && (!manifest->block_hash || !has_hash ||
+		     seen != manifest->blocks))
+		ret = -EBADMSG;
+	if (ret < 0) {
+		flash_manifest_free(manifest);
+		return ret;
+	}
+	manifest->hash = hash;
+
+	return 0;
+}
+
+/*----------------------------------------------------------------------------
+ * @fn flash_manifest_save
+ *
+ * @brief Write a manifest file, replacing any previous one atomically
+ * @params  manifest [IN] - Manifest to write
+ * 			path [IN] - Manifest file
+ * @return  0 - Success
+ * 			-errno - Failure
+ *--------------------------------------------------------------------------*/
+int flash_manifest_save(const struct flash_manifest *manifest,
+			const char *path)
+{
+	char tmp[PATH_MAX];
+	uint64_t block;
+	FILE *out;
+	int fd;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp))
+		return -ENAMETOOLONG;
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		return -errno;
+	fchmod(fd, 0644);
+	out = fdopen(fd, "w");
+	if (!out) {
+		close(fd);
+		unlink(tmp);
+		return -ENOMEM;
+	}
+
+	fprintf(out, "version=%d\n", FLASH_MANIFEST_VERSION);
+	fprintf(out, "size=%" PRIu64 "\n", manifest->size);
+	fprintf(out, "block=%" PRIu32 "\n", manifest->block_size);
+	fprintf(out, "hash=crc32:%08" PRIx32 "\n", manifest->hash);
+	for (block = 0; block < manifest->blocks; block++)
+		fprintf(out, "block.%" PRIu64 "=crc32:%08" PRIx32 "\n", block,
+			manifest->block_hash[block]);
+
+	if (fclose(out) || rename(tmp, path)) {
+		unlink(tmp);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+void flash_manifest_free(struct flash_manifest *manifest)
+{
+	free(manifest->block_hash);
+	memset(manifest, 0, sizeof(*manifest));
+}
+
+/*----------------------------------------------------------------------------
+ * @fn flash_manifest_compare
+ *
+ * @brief Hash the flash range holding an image and compare it with the
+ * image manifest, one flash buffer at a time
+ * @params  manifest [IN] - Manifest of the image
+ * 			flash [IN] - Flash handle
+ * 			offset [IN] - Flash offset of the image
+ * 			dirty [OUT] - One byte per block, set when the block differs
+ * @return  Number of differing blocks, 0 when the device holds the image
+ * 			-errno - Failure
+ *--------------------------------------------------------------------------*/
+int64_t flash_manifest_compare(const struct flash_manifest *manifest,
+			       struct mtd_flash *flash, uint64_t offset,
+			       uint8_t *dirty)
+{
+	uint32_t *block_hash, hash = crc32(0, NULL, 0);
+	uint64_t done, block;
+	int64_t differ = 0;
+	size_t chunk;
+	int ret;
+
+	if (!manifest->block_size || flash->bufsize % manifest->block_size)
+		return -EINVAL;
+	if (offset + manifest->size > flash->mtd.size)
+		return -EINVAL;
+
+	block_hash = calloc(manifest->blocks ? manifest->blocks : 1,
+			    sizeof(*block_hash));
+	if (!block_hash)
+		return -ENOMEM;
+
+	posix_fadvise(flash->fd, offset, manifest->size, POSIX_FADV_SEQUENTIAL);
+	for (done = 0; done < manifest->size; done += chunk) {
+		chunk = manifest->size - done < flash->bufsize ?
+				manifest->size - done : flash->bufsize;
+		ret = mtd_flash_read(flash, offset + done, flash->vbuf, chunk);
+		if (ret < 0) {
+			free(block_hash);
+			return ret;
+		}
+		flash_manifest_hash(block_hash, &hash, manifest->block_size,
+				    done, flash->vbuf, chunk);
+	}
+
+	for (block = 0; block < manifest->blocks; block++) {
+		dirty[block] = block_hash[block] != manifest->block_hash[block];
+		differ += dirty[block];
+	}
+	free(block_hash);
+
+	/* Block hashes agreeing with a different image hash: trust nothing */
+	if (!differ && hash != manifest->hash) {
+		memset(dirty, 1, manifest->blocks);
+		differ = manifest->blocks;
+	}
+
+	return differ;
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2021 Ampere Computing LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Flash image manifests: the image size, the block size and a CRC32 of
+ * every block and of the whole image, kept in a sidecar text file so a
+ * device can be checked against an image without reading the image.
+ *
+ *	version=1
+ *	size=<image size in bytes>
+ *	block=<block size in bytes>
+ *	hash=crc32:<whole image>
+ *	block.<n>=crc32:<block n>	(one line per block)
+ */
+
+#ifndef FLASH_MANIFEST_H
+#define FLASH_MANIFEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mtd_flash.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FLASH_MANIFEST_VERSION	1
+
+struct flash_manifest {
+	uint64_t size;
+	uint32_t block_size;
+	uint32_t hash;
+	uint64_t blocks;
+	uint32_t *block_hash;
+};
+
+static inline uint64_t flash_manifest_blocks(uint64_t size,
+					     uint32_t block_size)
+{
+	return (size + block_size - 1) / block_size;
+}
+
+/*
+ * All functions returning int return 0 on success and a negative errno
+ * value on failure. -EBADMSG means a malformed manifest file.
+ */
+int flash_manifest_init(struct flash_manifest *manifest, uint64_t size,
+			uint32_t block_size);
+void flash_manifest_update(struct flash_manifest *manifest, uint64_t pos,
+			   const void *buf, size_t count);
+int flash_manifest_generate(struct flash_manifest *manifest, int fd,
+			    uint64_t size, uint32_t block_size);
+int flash_manifest_load(struct flash_manifest *manifest, const char *path);
+int flash_manifest_save(const struct flash_manifest *manifest,
+			const char *path);
+void flash_manifest_free(struct flash_manifest *manifest);
+
+/*
+ * Hash the flash range holding the image at offset, one bufsize read at a
+ * time, and flag the blocks whose hash differs from the manifest in dirty
+ * (one byte per block). The manifest block size must divide the flash
+ * buffer size. Returns the number of differing blocks, 0 when the whole
+ * image hash matches too, or a negative errno value.
+ */
+int64_t flash_manifest_compare(const struct flash_manifest *manifest,
+			       struct mtd_flash *flash, uint64_t offset,
+			       uint8_t *dirty);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FLASH_MANIFEST_H */
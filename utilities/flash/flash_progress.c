@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2021 Ampere Computing LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Rate limited text and JSON progress reporting.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "flash_progress.h"
+
+static uint64_t flash_progress_now_us(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+void flash_progress_init(struct flash_progress *progress, int fd)
+{
+	memset(progress, 0, sizeof(*progress));
+	progress->fd = fd;
+	progress->interval_us = FLASH_PROGRESS_INTERVAL_US;
+}
+
+bool flash_progress_due(struct flash_progress *progress, const char *phase,
+			uint64_t done, uint64_t total)
+{
+	uint64_t now = flash_progress_now_us();
+
+	if (!progress->phase || strcmp(progress->phase, phase) ||
+	    done < progress->last_done) {
+		progress->phase = phase;
+		progress->start_us = now;
+		progress->last_us = now;
+		progress->last_done = done;
+		progress->mbps = 0;
+		return true;
+	}
+
+	if (done != total && now - progress->last_us < progress->interval_us)
+		return false;
+
+	/* Bytes per microsecond is MB/s */
+	progress->mbps = now > progress->last_us ?
+		(double)(done - progress->last_done) /
+			(now - progress->last_us) : 0;
+	progress->last_us = now;
+	progress->last_done = done;
+
+	return true;
+}
+
+/* Write a whole line, dropping it if the reader is gone */
+static void flash_progress_write(int fd, const char *buf, int len)
+{
+	ssize_t ret;
+
+	if (len <= 0)
+		return;
+	while (len) {
+		ret = write(fd, buf, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return;
+		buf += ret;
+		len -= ret;
+	}
+}
+
+void flash_progress_json(struct flash_progress *progress, const char *device,
+			 const char *phase, uint64_t done, uint64_t total)
+{
+	char line[PATH_MAX + 160];
+	int len;
+
+	if (progress->fd < 0 ||
+	    !flash_progress_due(progress, phase, done, total))
+		return;
+
+	len = snprintf(line, sizeof(line),
+		       "{\"device\":\"%s\",\"phase\":\"%s\",\"done\":%llu,"
+		       "\"total\":%llu,\"mbps\":%.2f,\"elapsed_ms\":%llu}\n",
+		       device, phase, (unsigned long long)done,
+		       (unsigned long long)total, progress->mbps,
+		       (unsigned long long)((progress->last_us -
+					     progress->start_us) / 1000));
+	if (len >= (int)sizeof(line))
+		return;
+	flash_progress_write(progress->fd, line, len);
+}
+
+void flash_progress_json_result(struct flash_progress *progress,
+				const char *device, const char *result,
+				uint64_t elapsed_us)
+{
+	char line[PATH_MAX + 160];
+	int len;
+
+	if (progress->fd < 0)
+		return;
+
+	len = snprintf(line, sizeof(line),
+		       "{\"device\":\"%s\",\"phase\":\"result\",\"result\":\"%s\","
+		       "\"elapsed_ms\":%llu}\n", device, result,
+		       (unsigned long long)(elapsed_us / 1000));
+	if (len >= (int)sizeof(line))
+		return;
+	flash_progress_write(progress->fd, line, len);
+}
+
+void flash_progress_json_cb(const struct mtd_flash *flash,
+			    enum mtd_flash_stage stage, uint64_t done,
+			    uint64_t total, void *priv)
+{
+	flash_progress_json(priv, flash->path, mtd_flash_stage_name(stage),
+			    done, total);
+}
+
+const char *mtd_flash_stage_name(enum mtd_flash_stage stage)
+{
+	switch (stage) {
+	case MTD_FLASH_ERASE:
+		return "erase";
+	case MTD_FLASH_PROGRAM:
+		return "program";
+	case MTD_FLASH_VERIFY:
+		return "verify";
+	case MTD_FLASH_READ:
+		return "read";
+	}
+
+	return "unknown";
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2021 Ampere Computing LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Rate limited progress reporting for the flash utilities. Updates are let
+ * through at the start and end of a phase and at most once per interval in
+ * between. In JSON mode each update is written to a file descriptor as one
+ * line with a single write():
+ *
+ *	{"device":"/dev/mtd5","phase":"program","done":1048576,
+ *	 "total":33554432,"mbps":1.52,"elapsed_ms":690}
+ *
+ * and a final {"device":...,"phase":"result","result":"ok",...} line.
+ */
+
+#ifndef FLASH_PROGRESS_H
+#define FLASH_PROGRESS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mtd_flash.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FLASH_PROGRESS_INTERVAL_US	(250 * 1000)
+
+struct flash_progress {
+	/* JSON output, -1 for text mode where only flash_progress_due is used */
+	int fd;
+	uint64_t interval_us;
+	/* Current phase */
+	const char *phase;
+	uint64_t start_us;
+	uint64_t last_us;
+	uint64_t last_done;
+	/* MB/s since the previous update let through */
+	double mbps;
+};
+
+void flash_progress_init(struct flash_progress *progress, int fd);
+
+/*
+ * Return true when an update should be shown: the first or last one of a
+ * phase, or the first one after the interval. Also updates mbps.
+ */
+bool flash_progress_due(struct flash_progress *progress, const char *phase,
+			uint64_t done, uint64_t total);
+
+/* Write a JSON progress line if flash_progress_due lets it through */
+void flash_progress_json(struct flash_progress *progress, const char *device,
+			 const char *phase, uint64_t done, uint64_t total);
+
+/* Write the final JSON line of a device, always */
+void flash_progress_json_result(struct flash_progress *progress,
+				const char *device, const char *result,
+				uint64_t elapsed_us);
+
+/* mtd_flash_progress_t writing JSON lines, priv is a struct flash_progress */
+void flash_progress_json_cb(const struct mtd_flash *flash,
+			    enum mtd_flash_stage stage, uint64_t done,
+			    uint64_t total, void *priv);
+
+const char *mtd_flash_stage_name(enum mtd_flash_stage stage);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FLASH_PROGRESS_H */
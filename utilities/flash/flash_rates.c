@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2021 Ampere Computing LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Measured flash device rates cache.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "flash_rates.h"
+
+/* Weight of a new measurement in the moving average, 1/N */
+#define FLASH_RATES_WEIGHT	4
+
+static int flash_rates_match(const struct mtd_flash *flash, const char *line,
+			     struct flash_rates *rates)
+{
+	char path[PATH_MAX];
+	uint64_t size;
+	uint32_t erasesize;
+
+	memset(rates, 0, sizeof(*rates));
+	if (sscanf(line, "%4095s %" SCNu64 " %" SCNu32 " erase=%" SCNu64
+		   " write=%" SCNu64 " read=%" SCNu64, path, &size, &erasesize,
+		   &rates->erase, &rates->write, &rates->read) != 6)
+		return 0;
+
+	return !strcmp(path, flash->path) && size == flash->mtd.size &&
+	       erasesize == flash->mtd.erasesize;
+}
+
+int flash_rates_get(const struct mtd_flash *flash, struct flash_rates *rates)
+{
+	char line[PATH_MAX + 128];
+	FILE *fp;
+
+	memset(rates, 0, sizeof(*rates));
+	fp = fopen(FLASH_RATES_FILE, "r");
+	if (!fp)
+		return -ENOENT;
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (flash_rates_match(flash, line, rates)) {
+			fclose(fp);
+			return 0;
+		}
+	}
+	fclose(fp);
+	memset(rates, 0, sizeof(*rates));
+
+	return -ENOENT;
+}
+
+/* Fold bytes done in us into a cached rate, ignoring tiny samples */
+static uint64_t flash_rates_fold(uint64_t rate, uint64_t bytes, uint64_t us,
+				 uint32_t min_bytes)
+{
+	uint64_t sample;
+
+	if (bytes < min_bytes || !us)
+		return rate;
+	sample = bytes * 1000000 / us;
+	if (!rate)
+		return sample;
+
+	return (rate * (FLASH_RATES_WEIGHT - 1) + sample) / FLASH_RATES_WEIGHT;
+}
+
+int flash_rates_record(const struct mtd_flash *flash)
+{
+	const struct mtd_flash_stats *stats = &flash->stats;
+	char line[PATH_MAX + 128], tmp[] = FLASH_RATES_FILE ".XXXXXX";
+	struct flash_rates rates;
+	FILE *in, *out;
+	int fd;
+
+	flash_rates_get(flash, &rates);
+	rates.erase = flash_rates_fold(rates.erase, stats->erased,
+				       stats->erase_us, flash->mtd.erasesize);
+	rates.write = flash_rates_fold(rates.write, stats->written,
+				       stats->write_us, flash->mtd.erasesize);
+	rates.read = flash_rates_fold(rates.read, stats->read, stats->read_us,
+				      flash->mtd.erasesize);
+
+	if (mkdir(FLASH_RATES_DIR, 0755) && errno != EEXIST)
+		return -errno;
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		return -errno;
+	fchmod(fd, 0644);
+	out = fdopen(fd, "w");
+	if (!out) {
+		close(fd);
+		unlink(tmp);
+		return -ENOMEM;
+	}
+
+	/* Copy the other devices, then this one */
+	in = fopen(FLASH_RATES_FILE, "r");
+	if (in) {
+		struct flash_rates other;
+
+		while (fgets(line, sizeof(line), in))
+			if (!flash_rates_match(flash, line, &other))
+				fputs(line, out);
+		fclose(in);
+	}
+	fprintf(out, "%s %" PRIu64 " %" PRIu32 " erase=%" PRIu64 " write=%"
+		PRIu64 " read=%" PRIu64 "\n", flash->path,
+		(uint64_t)flash->mtd.size, (uint32_t)flash->mtd.erasesize,
+		rates.erase, rates.write, rates.read);
+
+	if (fclose(out) || rename(tmp, FLASH_RATES_FILE)) {
+		unlink(tmp);
+		return -EIO;
+	}
+
+	return 0;
+}
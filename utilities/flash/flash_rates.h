@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2021 Ampere Computing LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Persistent per-device erase, write and read rates measured by earlier
+ * flash runs, used to estimate how long an update will take. One line per
+ * device, keyed by device node, size and erase block size:
+ *
+ *	/dev/mtd5 33554432 65536 erase=412345 write=1023456 read=20971520
+ */
+
+#ifndef FLASH_RATES_H
+#define FLASH_RATES_H
+
+#include "mtd_flash.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FLASH_RATES_DIR		"/var/lib/ampere-flash"
+#define FLASH_RATES_FILE	FLASH_RATES_DIR "/rates"
+
+/* Bytes per second, 0 when not measured yet */
+struct flash_rates {
+	uint64_t erase;
+	uint64_t write;
+	uint64_t read;
+};
+
+/* Return 0 with the cached rates of a device, or -ENOENT */
+int flash_rates_get(const struct mtd_flash *flash, struct flash_rates *rates);
+
+/*
+ * Fold the rates measured in flash->stats into the cache, as a moving
+ * average with the earlier runs. Returns 0 or a negative errno value.
+ */
+int flash_rates_record(const struct mtd_flash *flash);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FLASH_RATES_H */
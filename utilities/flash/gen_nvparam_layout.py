@@ -0,0 +1,202 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2021 Ampere Computing LLC
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#	http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# Compile a NVPARAM layout definition into a C header holding the parameter
+# table and a perfect hash index over the parameter names.
+#
+# Usage: gen_nvparam_layout.py <layout.def> <nvparam_layout.h>
+
+import sys
+
+TYPES = {
+    'u8': 'NVPARAM_TYPE_U8',
+    'u16': 'NVPARAM_TYPE_U16',
+    'u32': 'NVPARAM_TYPE_U32',
+    'bool': 'NVPARAM_TYPE_BOOL',
+}
+
+# Must match nvparam_layout_hash() in the generated header
+FNV_PRIME = 0x01000193
+MAX_SEED = 1 << 20
+
+
+def fnv1a(name, seed):
+    h = (0x811c9dc5 ^ seed) & 0xffffffff
+    for c in name.encode():
+        h ^= c
+        h = (h * FNV_PRIME) & 0xffffffff
+    return h
+
+
+def parse(path):
+    params = []
+    names = set()
+    offsets = set()
+    with open(path) as f:
+        for lineno, line in enumerate(f, 1):
+            line = line.split('#', 1)[0].strip()
+            if not line:
+                continue
+            fields = line.split()
+            if len(fields) != 4:
+                sys.exit('%s:%d: expected <name> <offset> <type> <default>'
+                         % (path, lineno))
+            name, offset, ptype, default = fields
+            offset = int(offset, 0)
+            default = int(default, 0)
+            if ptype not in TYPES:
+                sys.exit('%s:%d: unknown type %s' % (path, lineno, ptype))
+            if name in names:
+                sys.exit('%s:%d: duplicate name %s' % (path, lineno, name))
+            if offset in offsets:
+                sys.exit('%s:%d: duplicate offset 0x%x' % (path, lineno, offset))
+            if offset % 8:
+                sys.exit('%s:%d: offset 0x%x is not entry aligned'
+                         % (path, lineno, offset))
+            names.add(name)
+            offsets.add(offset)
+            params.append((name, offset, ptype, default))
+    return params
+
+
+def build_index(params):
+    """Hash and displace: names are first hashed into buckets, then each
+    bucket gets a displacement seed placing all its names in free slots.
+    Single name buckets point at a free slot directly (negative value)."""
+    size = max(len(params), 1)
+    buckets = [[] for _ in range(size)]
+    for i, (name, _, _, _) in enumerate(params):
+        buckets[fnv1a(name, 0) % size].append(i)
+
+    disp = [0] * size
+    slots = [-1] * size
+    order = sorted(range(size), key=lambda b: -len(buckets[b]))
+    for b in order:
+        items = buckets[b]
+        if len(items) <= 1:
+            break
+        for seed in range(1, MAX_SEED):
+            placed = []
+            for i in items:
+                slot = fnv1a(params[i][0], seed) % size
+                if slots[slot] != -1 or slot in placed:
+                    break
+                placed.append(slot)
+            else:
+                for i, slot in zip(items, placed):
+                    slots[slot] = i
+                disp[b] = seed
+                break
+        else:
+            sys.exit('no displacement found for bucket %d' % b)
+
+    free = [slot for slot in range(size) if slots[slot] == -1]
+    for b in order:
+        if len(buckets[b]) == 1:
+            slot = free.pop()
+            slots[slot] = buckets[b][0]
+            disp[b] = -slot - 1
+
+    return disp, slots
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit('usage: %s <layout.def> <nvparam_layout.h>' % sys.argv[0])
+
+    params = parse(sys.argv[1])
+    disp, slots = build_index(params)
+
+    out = []
+    out.append('/* Generated by gen_nvparam_layout.py. Do not edit. */')
+    out.append('')
+    out.append('#ifndef NVPARAM_LAYOUT_H')
+    out.append('#define NVPARAM_LAYOUT_H')
+    out.append('')
+    out.append('#include <stdint.h>')
+    out.append('#include <string.h>')
+    out.append('')
+    out.append('enum nvparam_type {')
+    for t in TYPES.values():
+        out.append('\t%s,' % t)
+    out.append('};')
+    out.append('')
+    out.append('struct nvparam_layout_entry {')
+    out.append('\tconst char *name;')
+    out.append('\tuint32_t offset;')
+    out.append('\tenum nvparam_type type;')
+    out.append('\tuint32_t def;')
+    out.append('};')
+    out.append('')
+    out.append('#define NVPARAM_LAYOUT_COUNT\t%d' % len(params))
+    out.append('#define NVPARAM_LAYOUT_SLOTS\t%d' % len(slots))
+    out.append('')
+    out.append('static const struct nvparam_layout_entry '
+               'nvparam_layout[NVPARAM_LAYOUT_COUNT + 1] = {')
+    for name, offset, ptype, default in params:
+        out.append('\t{ "%s", 0x%x, %s, 0x%x },'
+                   % (name, offset, TYPES[ptype], default))
+    out.append('\t{ NULL, 0, NVPARAM_TYPE_U32, 0 },')
+    out.append('};')
+    out.append('')
+    out.append('static const int32_t nvparam_layout_disp[NVPARAM_LAYOUT_SLOTS]'
+               ' = {')
+    for i in range(0, len(disp), 8):
+        out.append('\t' + ' '.join('%d,' % d for d in disp[i:i + 8]))
+    out.append('};')
+    out.append('')
+    out.append('static const int16_t nvparam_layout_index[NVPARAM_LAYOUT_SLOTS]'
+               ' = {')
+    for i in range(0, len(slots), 8):
+        out.append('\t' + ' '.join('%d,' % s for s in slots[i:i + 8]))
+    out.append('};')
+    out.append('')
+    out.append('static inline uint32_t nvparam_layout_hash(const char *name,')
+    out.append('\t\t\t\t\t       uint32_t seed)')
+    out.append('{')
+    out.append('\tuint32_t h = 0x811c9dc5 ^ seed;')
+    out.append('')
+    out.append('\twhile (*name) {')
+    out.append('\t\th ^= (uint8_t)*name++;')
+    out.append('\t\th *= 0x%08x;' % FNV_PRIME)
+    out.append('\t}')
+    out.append('')
+    out.append('\treturn h;')
+    out.append('}')
+    out.append('')
+    out.append('static inline const struct nvparam_layout_entry *')
+    out.append('nvparam_layout_find(const char *name)')
+    out.append('{')
+    out.append('\tint32_t d = nvparam_layout_disp[nvparam_layout_hash(name, 0) %')
+    out.append('\t\t\t\t\t  NVPARAM_LAYOUT_SLOTS];')
+    out.append('\tuint32_t slot = d < 0 ? (uint32_t)(-d - 1) :')
+    out.append('\t\t\t\tnvparam_layout_hash(name, d) % NVPARAM_LAYOUT_SLOTS;')
+    out.append('\tint16_t i = nvparam_layout_index[slot];')
+    out.append('')
+    out.append('\tif (i < 0 || strcmp(nvparam_layout[i].name, name))')
+    out.append('\t\treturn NULL;')
+    out.append('')
+    out.append('\treturn &nvparam_layout[i];')
+    out.append('}')
+    out.append('')
+    out.append('#endif /* NVPARAM_LAYOUT_H */')
+
+    with open(sys.argv[2], 'w') as f:
+        f.write('\n'.join(out) + '\n')
+
+
+if __name__ == '__main__':
+    main()
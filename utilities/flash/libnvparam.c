@@ -0,0 +1,522 @@
+/*
+ * Copyright (c) 2020 Ampere Computing LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * NVPARAM flash access library shared by the nvparm application and the
+ * NVPARAM D-Bus service.
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "libnvparam.h"
+#include "mtd_flash.h"
+#include "mtd_resolve.h"
+
+/*----------------------------------------------------------------------------
+ * @fn nvparam_find_mtd
+ *
+ * @brief Find the MTD device node of the host SPI NOR
+ * @params  path [OUT] - Buffer receiving the device path (e.g. /dev/mtd5)
+ * 			len [IN] - Size of path buffer
+ * @return  0 - Success
+ * 			-errno - Failure
+ *--------------------------------------------------------------------------*/
+int nvparam_find_mtd(char *path, size_t len)
+{
+	return mtd_resolve(NVPARAM_HOST_SPI_MTD_NAME, path, len);
+}
+
+/*----------------------------------------------------------------------------
+ * @fn nvparam_open
+ *
+ * @brief Locate and open the host SPI NOR device and fetch its MTD info.
+ * An exclusive lock is taken on the device and held until nvparam_close, so
+ * libnvparam users (nvparm, the NVPARAM service) never interleave updates;
+ * this waits while another user holds it.
+ * @params  dev [OUT] - Device handle to initialize
+ * @return  0 - Success
+ * 			-errno - Failure
+ *--------------------------------------------------------------------------*/
+int nvparam_open(struct nvparam_dev *dev)
+{
+	int ret;
+
+	dev->shadow_enabled = 0;
+
+	ret = mtd_flash_open(&dev->flash, NVPARAM_HOST_SPI_MTD_NAME);
+	if (ret < 0)
+		return ret;
+
+	while (flock(dev->flash.fd, LOCK_EX) < 0) {
+		if (errno != EINTR) {
+			ret = -errno;
+			mtd_flash_close(&dev->flash);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+/*----------------------------------------------------------------------------
+ * @fn nvparam_close
+ *
+ * @brief Close a device opened by nvparam_open
+ * @params  dev [IN] - Device handle
+ *--------------------------------------------------------------------------*/
+void nvparam_close(struct nvparam_dev *dev)
+{
+	mtd_flash_close(&dev->flash);
+}
+
+/*----------------------------------------------------------------------------
+ * @fn nvparam_block_base
+ *
+ * @brief Get the erase block base of an offset
+ * @params  dev [IN] - Device handle
+ * 			offset [IN] - SPI NOR offset
+ * 			base [OUT] - Offset of the erase block containing offset
+ * @return  0 - Success
+ * 			-EINVAL - Offset is out of the device range
+ *--------------------------------------------------------------------------*/
+int nvparam_block_base(const struct nvparam_dev *dev, unsigned long offset,
+		       unsigned long *base)
+{
+	if (offset >= dev->flash.mtd.size)
+		return -EINVAL;
+
+	*base = (offset / dev->flash.mtd.erasesize) * dev->flash.mtd.erasesize;
+
+	return 0;
+}
+
+/*----------------------------------------------------------------------------
+ * @fn nvparam_erase_block
+ *
+ * @brief Erase one erase block
+ * @params  dev [IN] - Device handle
+ * 			base [IN] - Offset of the erase block
+ * @return  0 - Success
+ * 			-errno - Failure
+ *--------------------------------------------------------------------------*/
+int nvparam_erase_block(struct nvparam_dev *dev, unsigned long base)
+{
+	return mtd_flash_erase(&dev->flash, base, dev->flash.mtd.erasesize);
+}
+
+/*----------------------------------------------------------------------------
+ * @fn nvparam_read
+ *
+ * @brief Read raw content from the device
+ * @params  dev [IN] - Device handle
+ * 			offset [IN] - SPI NOR offset to read from
+ * 			buf [OUT] - Buffer contains read data
+ * 			count [IN] - Size to read in bytes
+ * @return  0 - Success
+ * 			-errno - Failure
+ *--------------------------------------------------------------------------*/
+int nvparam_read(struct nvparam_dev *dev, unsigned long offset, void *buf,
+		 size_t count)
+{
+	return mtd_flash_read(&dev->flash, offset, buf, count);
+}
+
+/*----------------------------------------------------------------------------
+ * @fn nvparam_write
+ *
+ * @brief Program raw content to an already erased area of the device
+ * @params  dev [IN] - Device handle
+ * 			offset [IN] - SPI NOR offset to write to
+ * 			buf [IN] - Data to write
+ * 			count [IN] - Size to write in bytes
+ * @return  0 - Success
+ * 			-errno - Failure
+ *--------------------------------------------------------------------------*/
+int nvparam_write(struct nvparam_dev *dev, unsigned long offset,
+		  const void *buf, size_t count)
+{
+	return mtd_flash_write(&dev->flash, offset, buf, count);
+}
+
+/*----------------------------------------------------------------------------
+ * @fn nvparam_read_block
+ *
+ * @brief Read one erase block of NVPARAM
+ * @params  dev [IN] - Device handle
+ * 			base [IN] - Offset of the erase block
+ * 			buf [OUT] - Buffer of mtd.erasesize bytes
+ * @return  0 - Success
+ * 			-errno - Failure
+ *--------------------------------------------------------------------------*/
+int nvparam_read_block(struct nvparam_dev *dev, unsigned long base, void *buf)
+{
+	return nvparam_read(dev, base, buf, dev->flash.mtd.erasesize);
+}
+
+/*----------------------------------------------------------------------------
+ * @fn nvparam_program_block
+ *
+ * @brief Erase, program and verify one erase block
+ * @params  dev [IN] - Device handle
+ * 			base [IN] - Offset of the erase block
+ * 			buf [IN] - New content of mtd.erasesize bytes
+ * @return  0 - Success
+ * 			-errno - Failure
+ *--------------------------------------------------------------------------*/
+static int nvparam_program_block(struct nvparam_dev *dev, unsigned long base,
+				 const void *buf)
+{
+	int ret;
+
+	ret = nvparam_erase_block(dev, base);
+	if (ret < 0)
+		return ret;
+
+	ret = nvparam_write(dev, base, buf, dev->flash.mtd.erasesize);
+	if (ret < 0)
+		return ret;
+
+	/* The engine verify buffer holds at least one erase block */
+	ret = nvparam_read_block(dev, base, dev->flash.vbuf);
+	if (ret == 0 && memcmp(dev->flash.vbuf, buf, dev->flash.mtd.erasesize))
+		ret = -EIO;
+
+	return ret;
+}
+
+/*----------------------------------------------------------------------------
+ * @fn nvparam_shadow_rec_valid
+ *
+ * @brief Check magic and self CRC of a shadow journal record
+ * @params  rec [IN] - Record to check
+ * @return  1 - Valid
+ * 			0 - Empty, torn or corrupted
+ *--------------------------------------------------------------------------*/
+static int nvparam_shadow_rec_valid(const struct nvparam_shadow_rec *rec)
+{
+	return rec->magic == NVPARAM_SHADOW_MAGIC &&
+	       rec->rec_crc == crc32(0, (const Bytef *)rec,
+				     offsetof(struct nvparam_shadow_rec, rec_crc));
+}
+
+/*----------------------------------------------------------------------------
+ * @fn nvparam_shadow_last
+ *
+ * @brief Find the newest valid record and the first free slot in the journal
+ * @params  dev [IN] - Device handle
+ * 			last [OUT] - Newest valid record, magic is 0 if there is none
+ * 			last_slot [OUT] - Index of the newest valid record
+ * 			next [OUT] - Index of the first free slot
+ * @return  0 - Success
+ * 			-errno - Failure
+ *--------------------------------------------------------------------------*/
+static int nvparam_shadow_last(struct nvparam_dev *dev,
+			       struct nvparam_shadow_rec *last,
+			       unsigned *last_slot, unsigned *next)
+{
+	unsigned slots = dev->flash.mtd.erasesize / sizeof(struct nvparam_shadow_rec);
+	struct nvparam_shadow_rec *journal, empty;
+	unsigned i;
+	int ret;
+
+	journal = malloc(dev->flash.mtd.erasesize);
+	if (!journal)
+		return -ENOMEM;
+
+	ret = nvparam_read_block(dev, dev->shadow_base + dev->flash.mtd.erasesize,
+				 journal);
+	if (ret < 0) {
+		free(journal);
+		return ret;
+	}
+
+	memset(&empty, 0xFF, sizeof(empty));
+	memset(last, 0, sizeof(*last));
+	*last_slot = 0;
+	for (i = 0; i < slots; i++) {
+		if (!memcmp(&journal[i], &empty, sizeof(empty)))
+			break;
+		if (nvparam_shadow_rec_valid(&journal[i]) &&
+		    journal[i].generation >= last->generation) {
+			*last = journal[i];
+			*last_slot = i;
+		}
+	}
+	*next = i;
+	free(journal);
+
+	return 0;
+}
+
+/*----------------------------------------------------------------------------
+ * @fn nvparam_shadow_done
+ *
+ * @brief Mark a journal record committed to its live block, by programming
+ * its done word to 0 without an erase
+ * @params  dev [IN] - Device handle
+ * 			slot [IN] - Index of the record in the journal
+ * @return  0 - Success
+ * 			-errno - Failure
+ *--------------------------------------------------------------------------*/
+static int nvparam_shadow_done(struct nvparam_dev *dev, unsigned slot)
+{
+	uint32_t done = 0;
+
+	return nvparam_write(dev, dev->shadow_base + dev->flash.mtd.erasesize +
+			     slot * sizeof(struct nvparam_shadow_rec) +
+			     offsetof(struct nvparam_shadow_rec, done),
+			     &done, sizeof(done));
+}
+
+/*----------------------------------------------------------------------------
+ * @fn nvparam_enable_shadow
+ *
+ * @brief Enable A/B shadow mode and recover an interrupted commit. If the
+ * newest journal record is still in flight and describes a valid shadow
+ * copy while its live block does not match it, the live block was torn by a
+ * power loss and is restored from the shadow copy. A record marked done is
+ * never replayed, whatever the live block holds now.
+ * @params  dev [IN] - Device handle
+ * 			shadow_base [IN] - Offset of the shadow data block, the
+ * 			journal block follows it
+ * @return  0 - Success
+ * 			-EUCLEAN - Neither copy of the in-flight block is valid,
+ * 			the record is left in flight
+ * 			-errno - Failure
+ *--------------------------------------------------------------------------*/
+int nvparam_enable_shadow(struct nvparam_dev *dev, unsigned long shadow_base)
+{
+	struct nvparam_shadow_rec last;
+	uint8_t *live, *shadow;
+	unsigned slot, next;
+	int ret;
+
+	if (shadow_base % dev->flash.mtd.erasesize ||
+	    shadow_base + NVPARAM_SHADOW_BLOCKS * dev->flash.mtd.erasesize >
+	    dev->flash.mtd.size)
+		return -EINVAL;
+
+	dev->shadow_base = shadow_base;
+	dev->shadow_enabled = 1;
+
+	ret = nvparam_shadow_last(dev, &last, &slot, &next);
+	if (ret < 0 || !last.magic || last.done != 0xFFFFFFFF)
+		return ret;
+
+	live = malloc(dev->flash.mtd.erasesize);
+	shadow = malloc(dev->flash.mtd.erasesize);
+	if (!live || !shadow) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	ret = nvparam_read_block(dev, last.target, live);
+	if (ret < 0)
+		goto out;
+	if (crc32(0, live, dev->flash.mtd.erasesize) != last.data_crc) {
+		ret = nvparam_read_block(dev, shadow_base, shadow);
+		if (ret < 0)
+			goto out;
+		if (crc32(0, shadow, dev->flash.mtd.erasesize) != last.data_crc) {
+			ret = -EUCLEAN;
+			goto out;
+		}
+
+		ret = nvparam_program_block(dev, last.target, shadow);
+		if (ret < 0)
+			goto out;
+	}
+	ret = nvparam_shadow_done(dev, slot);
+out:
+	free(live);
+	free(shadow);
+
+	return ret;
+}
+
+/*----------------------------------------------------------------------------
+ * @fn nvparam_shadow_stage
+ *
+ * @brief Program the shadow copy of a block update and commit it to the
+ * journal, marked in flight. Once this returns the update survives a power
+ * loss.
+ * @params  dev [IN] - Device handle
+ * 			base [IN] - Offset of the live erase block
+ * 			buf [IN] - New content of mtd.erasesize bytes
+ * 			slot [OUT] - Index of the new journal record
+ * @return  0 - Success
+ * 			-errno - Failure
+ *--------------------------------------------------------------------------*/
+static int nvparam_shadow_stage(struct nvparam_dev *dev, unsigned long base,
+				const void *buf, unsigned *slot)
+{
+	unsigned long journal = dev->shadow_base + dev->flash.mtd.erasesize;
+	struct nvparam_shadow_rec last, rec;
+	unsigned last_slot, next;
+	int ret;
+
+	if (base + dev->flash.mtd.erasesize > dev->shadow_base &&
+	    base < dev->shadow_base + NVPARAM_SHADOW_BLOCKS * dev->flash.mtd.erasesize)
+		return -EINVAL;
+
+	ret = nvparam_program_block(dev, dev->shadow_base, buf);
+	if (ret < 0)
+		return ret;
+
+	ret = nvparam_shadow_last(dev, &last, &last_slot, &next);
+	if (ret < 0)
+		return ret;
+
+	/* The journal is only erased once all of its slots are used */
+	if (next == dev->flash.mtd.erasesize / sizeof(struct nvparam_shadow_rec)) {
+		ret = nvparam_erase_block(dev, journal);
+		if (ret < 0)
+			return ret;
+		next = 0;
+	}
+
+	memset(&rec, 0xFF, sizeof(rec));
+	rec.magic = NVPARAM_SHADOW_MAGIC;
+	rec.generation = last.generation + 1;
+	rec.target = base;
+	rec.data_crc = crc32(0, buf, dev->flash.mtd.erasesize);
+	rec.rec_crc = crc32(0, (const Bytef *)&rec,
+			    offsetof(struct nvparam_shadow_rec, rec_crc));
+	*slot = next;
+
+	return nvparam_write(dev, journal + next * sizeof(rec), &rec,
+			     sizeof(rec));
+}
+
+/*----------------------------------------------------------------------------
+ * @fn nvparam_commit_block
+ *
+ * @brief Replace the content of one erase block: erase, program and verify.
+ * In A/B shadow mode the update is staged and journaled first and the
+ * record marked done once the live block is verified. The live block is
+ * still erased only once, but the shadow block is erased on every update
+ * and the journal block whenever it fills up.
+ * @params  dev [IN] - Device handle
+ * 			base [IN] - Offset of the erase block
+ * 			buf [IN] - New content of mtd.erasesize bytes
+ * @return  0 - Success
+ * 			-errno - Failure
+ *--------------------------------------------------------------------------*/
+int nvparam_commit_block(struct nvparam_dev *dev, unsigned long base,
+			 const void *buf)
+{
+	unsigned slot;
+	int ret;
+
+	if (!dev->shadow_enabled)
+		return nvparam_program_block(dev, base, buf);
+
+	ret = nvparam_shadow_stage(dev, base, buf, &slot);
+	if (ret < 0)
+		return ret;
+
+	ret = nvparam_program_block(dev, base, buf);
+	if (ret < 0)
+		return ret;
+
+	return nvparam_shadow_done(dev, slot);
+}
+
+/*----------------------------------------------------------------------------
+ * @fn nvparam_crc16
+ *
+ * @brief Calculate CRC16
+ * @params  ptr [IN] - Input buffer to calculate CRC16 on
+ * 			count [IN] - Number of bytes to calculate CRC16
+ * @return  CRC16 value
+ *--------------------------------------------------------------------------*/
+uint16_t nvparam_crc16(const uint8_t *ptr, int count)
+{
+	int crc = 0;
+	int i;
+
+	while (--count >= 0) {
+		crc = crc ^ (int)*ptr++ << 8;
+		for (i = 0; i < 8; ++i) {
+			if (crc & 0x8000)
+				crc = crc << 1 ^ 0x1021;
+			else
+				crc = crc << 1;
+		}
+	}
+
+	return crc & 0xffff;
+}
+
+/*----------------------------------------------------------------------------
+ * @fn nvparam_entry_set
+ *
+ * @brief Fill a NVPARAM entry with a value and a matching CRC16
+ * @params  entry [OUT] - Entry to fill
+ * 			value [IN] - Parameter value
+ *--------------------------------------------------------------------------*/
+void nvparam_entry_set(struct nvparam_entry *entry, uint32_t value)
+{
+	entry->param1 = value;
+	/*
+	 * Set acl_rd, acl_wr and valid to all 1s as requirement of
+	 * host firmware team.
+	 */
+	entry->acl_rd = 0xFF;
+	entry->acl_wr = 0x7F;
+	entry->valid = 1;
+	/*
+	 * Calculate NVPRAM entry CRC16. CRC16 is calculated on whole NVPARAM
+	 * entry with crc16 = 0
+	 */
+	entry->crc16 = 0;
+	entry->crc16 = nvparam_crc16((const uint8_t *)entry,
+				     sizeof(struct nvparam_entry));
+}
+
+/*----------------------------------------------------------------------------
+ * @fn nvparam_entry_clear
+ *
+ * @brief Reset a NVPARAM entry to the erased state
+ * @params  entry [OUT] - Entry to clear
+ *--------------------------------------------------------------------------*/
+void nvparam_entry_clear(struct nvparam_entry *entry)
+{
+	memset((void *)entry, 0xFF, sizeof(struct nvparam_entry));
+}
+
+/*----------------------------------------------------------------------------
+ * @fn nvparam_entry_crc_ok
+ *
+ * @brief Check whether the CRC16 field of an entry matches its content
+ * @params  entry [IN] - Entry to check
+ * @return  1 - CRC16 matches
+ * 			0 - Mismatch
+ *--------------------------------------------------------------------------*/
+int nvparam_entry_crc_ok(const struct nvparam_entry *entry)
+{
+	struct nvparam_entry tmp = *entry;
+
+	tmp.crc16 = 0;
+
+	return entry->crc16 == nvparam_crc16((const uint8_t *)&tmp,
+					     sizeof(struct nvparam_entry));
+}
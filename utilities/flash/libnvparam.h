@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2020 Ampere Computing LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * NVPARAM flash access library shared by the nvparm application and the
+ * NVPARAM D-Bus service.
+ */
+
+#ifndef LIBNVPARAM_H
+#define LIBNVPARAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mtd_flash.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NVPARAM_HOST_SPI_MTD_NAME	"pnor"
+
+/*
+ * According to Altra Interface Firmware Requirement,
+ * size of NVPARAM partitions is 64KB.
+ */
+#define NVPARAM_PARTITION_SIZE		(64 * 1024)
+
+struct nvparam_entry {
+	uint32_t param1;
+	uint32_t acl_rd:8;
+	uint32_t acl_wr:7;
+	uint32_t valid:1;
+	uint32_t crc16:16;
+} __attribute__((__packed__));
+
+/*
+ * A/B shadow mode: a block update is first programmed to a shadow erase
+ * block, then committed by appending a record with a new generation to a
+ * journal erase block right after it, and only then written to the live
+ * block. Once the live block is verified the record's done word is
+ * programmed to 0 without an erase; only a record still marked in flight
+ * is recovered, so live writes made without shadow mode are never rolled
+ * back. The journal is append-only and erased only when full.
+ *
+ * Each update costs one extra erase of the shadow block, plus one erase of
+ * the journal block every mtd.erasesize / 32 updates.
+ */
+#define NVPARAM_SHADOW_MAGIC		0x4e564142	/* "NVAB" */
+#define NVPARAM_SHADOW_BLOCKS		2
+
+struct nvparam_shadow_rec {
+	uint32_t magic;
+	uint32_t generation;
+	uint32_t target;
+	uint32_t data_crc;
+	uint32_t reserved[2];
+	uint32_t rec_crc;
+	uint32_t done;		/* 0xFFFFFFFF while in flight, not in rec_crc */
+} __attribute__((__packed__));
+
+/* An opened host SPI NOR device holding the NVPARAM partitions */
+struct nvparam_dev {
+	struct mtd_flash flash;
+	int shadow_enabled;
+	unsigned long shadow_base;
+};
+
+/*
+ * All functions returning int return 0 on success and a negative errno
+ * value on failure. Nothing is printed; reporting is left to the caller.
+ */
+int nvparam_find_mtd(char *path, size_t len);
+/* Holds an exclusive flock() on the device until nvparam_close */
+int nvparam_open(struct nvparam_dev *dev);
+void nvparam_close(struct nvparam_dev *dev);
+
+int nvparam_block_base(const struct nvparam_dev *dev, unsigned long offset,
+		       unsigned long *base);
+int nvparam_erase_block(struct nvparam_dev *dev, unsigned long base);
+int nvparam_read(struct nvparam_dev *dev, unsigned long offset, void *buf,
+		 size_t count);
+int nvparam_write(struct nvparam_dev *dev, unsigned long offset,
+		  const void *buf, size_t count);
+int nvparam_read_block(struct nvparam_dev *dev, unsigned long base, void *buf);
+int nvparam_commit_block(struct nvparam_dev *dev, unsigned long base,
+			 const void *buf);
+int nvparam_enable_shadow(struct nvparam_dev *dev, unsigned long shadow_base);
+
+uint16_t nvparam_crc16(const uint8_t *ptr, int count);
+void nvparam_entry_set(struct nvparam_entry *entry, uint32_t value);
+void nvparam_entry_clear(struct nvparam_entry *entry);
+int nvparam_entry_crc_ok(const struct nvparam_entry *entry);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBNVPARAM_H */
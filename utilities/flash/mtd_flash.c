@@ -0,0 +1,498 @@
+/*
+ * Copyright (c) 2021 Ampere Computing LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * MTD flash engine shared by the flash utilities.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mtd_flash.h"
+#include "mtd_resolve.h"
+
+static uint64_t mtd_flash_now_us(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void mtd_flash_report(struct mtd_flash *flash,
+			     enum mtd_flash_stage stage, uint64_t done,
+			     uint64_t total)
+{
+	if (flash->progress)
+		flash->progress(flash, stage, done, total, flash->priv);
+}
+
+/*----------------------------------------------------------------------------
+ * @fn mtd_flash_open
+ *
+ * @brief Open an MTD device, fetch its info and allocate the I/O buffers
+ * @params  flash [OUT] - Flash handle to initialize
+ * 			device [IN] - Device node or MTD partition name
+ * @return  0 - Success
+ * 			-errno - Failure
+ *--------------------------------------------------------------------------*/
+int mtd_flash_open(struct mtd_flash *flash, const char *device)
+{
+	long pagesize = sysconf(_SC_PAGESIZE);
+	size_t bufsize;
+	int ret;
+
+	memset(flash, 0, sizeof(*flash));
+	flash->fd = -1;
+
+	ret = mtd_resolve(device, flash->path, sizeof(flash->path));
+	if (ret < 0)
+		return ret;
+
+	flash->fd = open(flash->path, O_SYNC | O_RDWR);
+	if (flash->fd < 0)
+		return -errno;
+
+	if (ioctl(flash->fd, MEMGETINFO, &flash->mtd) < 0 ||
+	    !flash->mtd.erasesize) {
+		ret = errno ? -errno : -EINVAL;
+		mtd_flash_close(flash);
+		return ret;
+	}
+
+	bufsize = MTD_FLASH_BUFSIZE_MIN + flash->mtd.erasesize - 1;
+	bufsize -= bufsize % flash->mtd.erasesize;
+	if (posix_memalign(&flash->buf, pagesize, bufsize) ||
+	    posix_memalign(&flash->vbuf, pagesize, bufsize)) {
+		mtd_flash_close(flash);
+		return -ENOMEM;
+	}
+	flash->bufsize = bufsize;
+
+	return 0;
+}
+
+/*----------------------------------------------------------------------------
+ * @fn mtd_flash_close
+ *
+ * @brief Close a device opened by mtd_flash_open and free its buffers
+ * @params  flash [IN] - Flash handle
+ *--------------------------------------------------------------------------*/
+void mtd_flash_close(struct mtd_flash *flash)
+{
+	if (flash->fd >= 0)
+		close(flash->fd);
+	flash->fd = -1;
+	free(flash->buf);
+	free(flash->vbuf);
+	flash->buf = NULL;
+	flash->vbuf = NULL;
+	flash->bufsize = 0;
+}
+
+/*----------------------------------------------------------------------------
+ * @fn mtd_flash_set_progress
+ *
+ * @brief Set the callback reporting erase, program and verify progress
+ * @params  flash [IN] - Flash handle
+ * 			progress [IN] - Callback, NULL to disable
+ * 			priv [IN] - Passed back to the callback
+ *--------------------------------------------------------------------------*/
+void mtd_flash_set_progress(struct mtd_flash *flash,
+			    mtd_flash_progress_t progress, void *priv)
+{
+	flash->progress = progress;
+	flash->priv = priv;
+}
+
+/*----------------------------------------------------------------------------
+ * @fn mtd_flash_erase
+ *
+ * @brief Erase the erase blocks covering a range. Without a progress
+ * callback the whole range is erased with a single request.
+ * @params  flash [IN] - Flash handle
+ * 			offset [IN] - Start of the range, erase block aligned
+ * 			length [IN] - Length of the range, rounded up to erase blocks
+ * @return  0 - Success
+ * 			-errno - Failure
+ *--------------------------------------------------------------------------*/
+int mtd_flash_erase(struct mtd_flash *flash, uint64_t offset, uint64_t length)
+{
+	struct erase_info_user erase;
+	uint64_t total, done, start = mtd_flash_now_us();
+
+	total = mtd_flash_blocks(flash, length) * flash->mtd.erasesize;
+	if (offset % flash->mtd.erasesize || offset + total > flash->mtd.size)
+		return -EINVAL;
+
+	if (!flash->progress) {
+		erase.start = offset;
+		erase.length = total;
+		if (ioctl(flash->fd, MEMERASE, &erase) < 0)
+			return -errno;
+		flash->stats.erased += total;
+		flash->stats.erase_us += mtd_flash_now_us() - start;
+		return 0;
+	}
+
+	mtd_flash_report(flash, MTD_FLASH_ERASE, 0, total);
+	erase.length = flash->mtd.erasesize;
+	for (done = 0; done < total; done += erase.length) {
+		erase.start = offset + done;
+		if (ioctl(flash->fd, MEMERASE, &erase) < 0)
+			return -errno;
+		flash->stats.erased += erase.length;
+		mtd_flash_report(flash, MTD_FLASH_ERASE, done + erase.length,
+				 total);
+	}
+	flash->stats.erase_us += mtd_flash_now_us() - start;
+
+	return 0;
+}
+
+/* pread count bytes at offset, -EIO if the file or device is too short */
+static int mtd_flash_pread(int fd, uint64_t offset, void *buf, size_t count)
+{
+	ssize_t ret;
+
+	while (count) {
+		ret = pread(fd, buf, count, offset);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		if (!ret)
+			return -EIO;
+		buf = (uint8_t *)buf + ret;
+		offset += ret;
+		count -= ret;
+	}
+
+	return 0;
+}
+
+/*----------------------------------------------------------------------------
+ * @fn mtd_flash_read
+ *
+ * @brief Read raw content from the device
+ * @params  flash [IN] - Flash handle
+ * 			offset [IN] - Offset to read from
+ * 			buf [OUT] - Buffer receiving the data
+ * 			count [IN] - Size to read in bytes
+ * @return  0 - Success
+ * 			-errno - Failure, -EIO on a short read
+ *--------------------------------------------------------------------------*/
+int mtd_flash_read(struct mtd_flash *flash, uint64_t offset, void *buf,
+		   size_t count)
+{
+	uint64_t start = mtd_flash_now_us();
+	int ret;
+
+	ret = mtd_flash_pread(flash->fd, offset, buf, count);
+	if (!ret) {
+		flash->stats.read += count;
+		flash->stats.read_us += mtd_flash_now_us() - start;
+	}
+
+	return ret;
+}
+
+/*----------------------------------------------------------------------------
+ * @fn mtd_flash_write
+ *
+ * @brief Program raw content into erased flash
+ * @params  flash [IN] - Flash handle
+ * 			offset [IN] - Offset to write to
+ * 			buf [IN] - Data to write
+ * 			count [IN] - Size to write in bytes
+ * @return  0 - Success
+ * 			-errno - Failure, -EIO on a short write
+ *--------------------------------------------------------------------------*/
+int mtd_flash_write(struct mtd_flash *flash, uint64_t offset,
+		    const void *buf, size_t count)
+{
+	uint64_t start = mtd_flash_now_us();
+	ssize_t ret;
+
+	flash->stats.written += count;
+	while (count) {
+		ret = pwrite(flash->fd, buf, count, offset);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		if (!ret)
+			return -EIO;
+		buf = (const uint8_t *)buf + ret;
+		offset += ret;
+		count -= ret;
+	}
+	flash->stats.write_us += mtd_flash_now_us() - start;
+
+	return 0;
+}
+
+/*----------------------------------------------------------------------------
+ * @fn mtd_flash_program_range
+ *
+ * @brief Copy part of an image file into erased flash, one buffer at a time.
+ * Every byte is written; the caller must have erased the range first, as
+ * NOR programming only clears bits.
+ * @params  flash [IN] - Flash handle
+ * 			fd [IN] - Image file descriptor
+ * 			file_offset [IN] - Image offset to copy from
+ * 			offset [IN] - Flash offset to program at
+ * 			length [IN] - Number of bytes to copy
+ * @return  0 - Success
+ * 			-errno - Failure
+ *--------------------------------------------------------------------------*/
+int mtd_flash_program_range(struct mtd_flash *flash, int fd,
+			    uint64_t file_offset, uint64_t offset,
+			    uint64_t length)
+{
+	uint64_t done;
+	size_t chunk;
+	int ret;
+
+	if (offset + length > flash->mtd.size)
+		return -EINVAL;
+
+	mtd_flash_report(flash, MTD_FLASH_PROGRAM, 0, length);
+	for (done = 0; done < length; done += chunk) {
+		chunk = length - done < flash->bufsize ? length - done :
+							 flash->bufsize;
+		ret = mtd_flash_pread(fd, file_offset + done, flash->buf, chunk);
+		if (ret < 0)
+			return ret;
+		ret = mtd_flash_write(flash, offset + done, flash->buf, chunk);
+		if (ret < 0)
+			return ret;
+		mtd_flash_report(flash, MTD_FLASH_PROGRAM, done + chunk, length);
+	}
+
+	return 0;
+}
+
+/*----------------------------------------------------------------------------
+ * @fn mtd_flash_program
+ *
+ * @brief Copy an image file into erased flash, one buffer at a time
+ * @params  flash [IN] - Flash handle
+ * 			fd [IN] - Image file descriptor, read from its start
+ * 			offset [IN] - Flash offset to program the image at
+ * 			length [IN] - Number of bytes to copy
+ * @return  0 - Success
+ * 			-errno - Failure
+ *--------------------------------------------------------------------------*/
+int mtd_flash_program(struct mtd_flash *flash, int fd, uint64_t offset,
+		      uint64_t length)
+{
+	return mtd_flash_program_range(flash, fd, 0, offset, length);
+}
+
+/*----------------------------------------------------------------------------
+ * @fn mtd_flash_verify_range
+ *
+ * @brief Compare part of an image file with the flash content
+ * @params  flash [IN] - Flash handle
+ * 			fd [IN] - Image file descriptor
+ * 			file_offset [IN] - Image offset to compare from
+ * 			offset [IN] - Flash offset holding that part of the image
+ * 			length [IN] - Number of bytes to compare
+ * 			mismatch [OUT] - Image offset of the first differing buffer
+ * @return  0 - Match
+ * 			-EBADMSG - Mismatch
+ * 			-errno - Failure
+ *--------------------------------------------------------------------------*/
+int mtd_flash_verify_range(struct mtd_flash *flash, int fd,
+			   uint64_t file_offset, uint64_t offset,
+			   uint64_t length, uint64_t *mismatch)
+{
+	uint64_t done;
+	size_t chunk;
+	int ret;
+
+	if (offset + length > flash->mtd.size)
+		return -EINVAL;
+
+	mtd_flash_report(flash, MTD_FLASH_VERIFY, 0, length);
+	for (done = 0; done < length; done += chunk) {
+		chunk = length - done < flash->bufsize ? length - done :
+							 flash->bufsize;
+		ret = mtd_flash_pread(fd, file_offset + done, flash->buf, chunk);
+		if (ret < 0)
+			return ret;
+		ret = mtd_flash_read(flash, offset + done, flash->vbuf, chunk);
+		if (ret < 0)
+			return ret;
+		if (memcmp(flash->buf, flash->vbuf, chunk)) {
+			if (mismatch)
+				*mismatch = file_offset + done;
+			return -EBADMSG;
+		}
+		mtd_flash_report(flash, MTD_FLASH_VERIFY, done + chunk, length);
+	}
+
+	return 0;
+}
+
+/*----------------------------------------------------------------------------
+ * @fn mtd_flash_verify
+ *
+ * @brief Compare an image file with the flash content
+ * @params  flash [IN] - Flash handle
+ * 			fd [IN] - Image file descriptor, read from its start
+ * 			offset [IN] - Flash offset the image was programmed at
+ * 			length [IN] - Number of bytes to compare
+ * 			mismatch [OUT] - Image offset of the first differing buffer
+ * @return  0 - Match
+ * 			-EBADMSG - Mismatch
+ * 			-errno - Failure
+ *--------------------------------------------------------------------------*/
+int mtd_flash_verify(struct mtd_flash *flash, int fd, uint64_t offset,
+		     uint64_t length, uint64_t *mismatch)
+{
+	return mtd_flash_verify_range(flash, fd, 0, offset, length, mismatch);
+}
+
+/* Double buffering state shared by mtd_flash_stream and its reader thread */
+struct mtd_flash_stream {
+	struct mtd_flash *flash;
+	uint64_t offset;
+	uint64_t length;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	void *slot[2];
+	size_t len[2];
+	int full[2];
+	int err;
+	int stop;
+};
+
+static void *mtd_flash_stream_reader(void *arg)
+{
+	struct mtd_flash_stream *s = arg;
+	uint64_t done;
+	size_t chunk;
+	int i, ret;
+
+	for (done = 0, i = 0; done < s->length; done += chunk, i ^= 1) {
+		pthread_mutex_lock(&s->lock);
+		while (s->full[i] && !s->stop)
+			pthread_cond_wait(&s->cond, &s->lock);
+		if (s->stop) {
+			pthread_mutex_unlock(&s->lock);
+			break;
+		}
+		pthread_mutex_unlock(&s->lock);
+
+		chunk = s->length - done < s->flash->bufsize ? s->length - done :
+							       s->flash->bufsize;
+		ret = mtd_flash_read(s->flash, s->offset + done, s->slot[i],
+				     chunk);
+
+		pthread_mutex_lock(&s->lock);
+		if (ret < 0)
+			s->err = ret;
+		else {
+			s->len[i] = chunk;
+			s->full[i] = 1;
+		}
+		pthread_cond_broadcast(&s->cond);
+		pthread_mutex_unlock(&s->lock);
+		if (ret < 0)
+			break;
+	}
+
+	return NULL;
+}
+
+/*----------------------------------------------------------------------------
+ * @fn mtd_flash_stream
+ *
+ * @brief Read a range of the device into a consumer, overlapping the flash
+ * reads with the consumer's work
+ * @params  flash [IN] - Flash handle
+ * 			offset [IN] - Start of the range
+ * 			length [IN] - Length of the range
+ * 			consume [IN] - Called with each buffer, in order
+ * 			priv [IN] - Passed to consume
+ * @return  0 - Success
+ * 			-errno - Read failure, or the value returned by consume
+ *--------------------------------------------------------------------------*/
+int mtd_flash_stream(struct mtd_flash *flash, uint64_t offset,
+		     uint64_t length, mtd_flash_consume_t consume, void *priv)
+{
+	struct mtd_flash_stream s = {
+		.flash = flash,
+		.offset = offset,
+		.length = length,
+		.slot = { flash->buf, flash->vbuf },
+	};
+	pthread_t reader;
+	uint64_t done;
+	size_t chunk;
+	int i, ret = 0;
+
+	if (offset + length > flash->mtd.size)
+		return -EINVAL;
+
+	pthread_mutex_init(&s.lock, NULL);
+	pthread_cond_init(&s.cond, NULL);
+	if (pthread_create(&reader, NULL, mtd_flash_stream_reader, &s)) {
+		pthread_cond_destroy(&s.cond);
+		pthread_mutex_destroy(&s.lock);
+		return -EAGAIN;
+	}
+
+	mtd_flash_report(flash, MTD_FLASH_READ, 0, length);
+	for (done = 0, i = 0; done < length; done += chunk, i ^= 1) {
+		pthread_mutex_lock(&s.lock);
+		while (!s.full[i] && !s.err)
+			pthread_cond_wait(&s.cond, &s.lock);
+		if (!s.full[i]) {
+			ret = s.err;
+			pthread_mutex_unlock(&s.lock);
+			break;
+		}
+		chunk = s.len[i];
+		pthread_mutex_unlock(&s.lock);
+
+		ret = consume(s.slot[i], chunk, done, priv);
+
+		pthread_mutex_lock(&s.lock);
+		s.full[i] = 0;
+		s.stop = ret != 0;
+		pthread_cond_broadcast(&s.cond);
+		pthread_mutex_unlock(&s.lock);
+		if (ret)
+			break;
+		mtd_flash_report(flash, MTD_FLASH_READ, done + chunk, length);
+	}
+
+	pthread_join(reader, NULL);
+	pthread_cond_destroy(&s.cond);
+	pthread_mutex_destroy(&s.lock);
+
+	return ret;
+}
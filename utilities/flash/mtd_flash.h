@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2021 Ampere Computing LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * MTD flash engine shared by ampere_flashcp, nvparm and libnvparam: device
+ * open and info, erase, program and verify through erase block sized,
+ * page aligned buffers, with progress reported through a callback.
+ */
+
+#ifndef MTD_FLASH_H
+#define MTD_FLASH_H
+
+#include <limits.h>
+#include <mtd/mtd-user.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Lower bound of the I/O buffer size, rounded up to whole erase blocks */
+#define MTD_FLASH_BUFSIZE_MIN		(64 * 1024)
+
+enum mtd_flash_stage {
+	MTD_FLASH_ERASE,
+	MTD_FLASH_PROGRAM,
+	MTD_FLASH_VERIFY,
+	MTD_FLASH_READ,
+};
+
+struct mtd_flash;
+
+/*
+ * Called with done == 0 when a stage starts, after every buffer or erase
+ * block, and with done == total when it completes. Byte counts.
+ */
+typedef void (*mtd_flash_progress_t)(const struct mtd_flash *flash,
+				     enum mtd_flash_stage stage,
+				     uint64_t done, uint64_t total,
+				     void *priv);
+
+/* Work done by the engine since the device was opened, for rate estimates */
+struct mtd_flash_stats {
+	uint64_t erased;
+	uint64_t erase_us;
+	uint64_t written;
+	uint64_t write_us;
+	uint64_t read;
+	uint64_t read_us;
+};
+
+struct mtd_flash {
+	int fd;
+	char path[PATH_MAX];
+	struct mtd_info_user mtd;
+	/* Page aligned buffers of bufsize bytes, a multiple of erasesize */
+	size_t bufsize;
+	void *buf;
+	void *vbuf;
+	mtd_flash_progress_t progress;
+	void *priv;
+	struct mtd_flash_stats stats;
+};
+
+/*
+ * All functions returning int return 0 on success and a negative errno
+ * value on failure. Nothing is printed; reporting is left to the caller.
+ */
+int mtd_flash_open(struct mtd_flash *flash, const char *device);
+void mtd_flash_close(struct mtd_flash *flash);
+void mtd_flash_set_progress(struct mtd_flash *flash,
+			    mtd_flash_progress_t progress, void *priv);
+
+/* Erase block iteration helpers */
+static inline uint64_t mtd_flash_block_base(const struct mtd_flash *flash,
+					    uint64_t offset)
+{
+	return offset - offset % flash->mtd.erasesize;
+}
+
+static inline uint64_t mtd_flash_blocks(const struct mtd_flash *flash,
+					uint64_t length)
+{
+	return (length + flash->mtd.erasesize - 1) / flash->mtd.erasesize;
+}
+
+int mtd_flash_erase(struct mtd_flash *flash, uint64_t offset,
+		    uint64_t length);
+int mtd_flash_read(struct mtd_flash *flash, uint64_t offset, void *buf,
+		   size_t count);
+int mtd_flash_write(struct mtd_flash *flash, uint64_t offset,
+		    const void *buf, size_t count);
+
+/*
+ * Copy length bytes of the image file fd, from its start, to offset.
+ * The range must already be erased.
+ */
+int mtd_flash_program(struct mtd_flash *flash, int fd, uint64_t offset,
+		      uint64_t length);
+/*
+ * Compare length bytes of the image file fd with the flash at offset.
+ * Returns -EBADMSG on a mismatch, with the image offset of the first
+ * differing buffer in mismatch when it is not NULL.
+ */
+int mtd_flash_verify(struct mtd_flash *flash, int fd, uint64_t offset,
+		     uint64_t length, uint64_t *mismatch);
+
+/*
+ * Called by mtd_flash_stream with consecutive parts of the range, in order.
+ * pos is relative to the start of the range. A non-zero return value stops
+ * the stream and is returned by mtd_flash_stream.
+ */
+typedef int (*mtd_flash_consume_t)(const void *buf, size_t count,
+				   uint64_t pos, void *priv);
+
+/*
+ * Read a range one buffer at a time and hand it to consume. A reader thread
+ * fills one buffer while the caller consumes the other.
+ */
+int mtd_flash_stream(struct mtd_flash *flash, uint64_t offset,
+		     uint64_t length, mtd_flash_consume_t consume, void *priv);
+
+/* Same as above for the image bytes starting at file_offset */
+int mtd_flash_program_range(struct mtd_flash *flash, int fd,
+			    uint64_t file_offset, uint64_t offset,
+			    uint64_t length);
+int mtd_flash_verify_range(struct mtd_flash *flash, int fd,
+			   uint64_t file_offset, uint64_t offset,
+			   uint64_t length, uint64_t *mismatch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MTD_FLASH_H */
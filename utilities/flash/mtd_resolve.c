@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2021 Ampere Computing LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * MTD partition name to device node resolver shared by the flash utilities.
+ *
+ * The first lookup enumerates /sys/class/mtd/mtdN/name and stores every
+ * name -> mtdN mapping in /run. Later lookups only read the cache and
+ * re-check the one sysfs name attribute they resolved to, so a partition
+ * table change is detected and the cache rebuilt.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "mtd_resolve.h"
+
+#define MTD_NAME_SIZE		64
+#define MTD_DEV_NAME_SIZE	16
+
+/*----------------------------------------------------------------------------
+ * @fn mtd_read_name
+ *
+ * @brief Read the partition name of an MTD device from sysfs
+ * @params  dev [IN] - MTD device name (e.g. mtd5)
+ * 			name [OUT] - Buffer receiving the partition name
+ * 			len [IN] - Size of name buffer
+ * @return  0 - Success
+ * 			-errno - Failure
+ *--------------------------------------------------------------------------*/
+static int mtd_read_name(const char *dev, char *name, size_t len)
+{
+	char attr[sizeof(MTD_SYSFS_CLASS_DIR) + MTD_DEV_NAME_SIZE + 8];
+	FILE *fp;
+	char *nl;
+
+	snprintf(attr, sizeof(attr), MTD_SYSFS_CLASS_DIR "/%s/name", dev);
+	fp = fopen(attr, "r");
+	if (!fp)
+		return -errno;
+
+	if (!fgets(name, len, fp)) {
+		fclose(fp);
+		return -EIO;
+	}
+	fclose(fp);
+
+	nl = strchr(name, '\n');
+	if (nl)
+		*nl = '\0';
+
+	return 0;
+}
+
+/*----------------------------------------------------------------------------
+ * @fn mtd_cache_lookup
+ *
+ * @brief Find a partition name in the /run cache
+ * @params  name [IN] - Partition name
+ * 			dev [OUT] - Buffer of MTD_DEV_NAME_SIZE receiving mtdN
+ * @return  0 - Found and still valid
+ * 			-ENOENT - Not cached or stale
+ *--------------------------------------------------------------------------*/
+static int mtd_cache_lookup(const char *name, char *dev)
+{
+	char line[MTD_NAME_SIZE + MTD_DEV_NAME_SIZE + 2];
+	char cur[MTD_NAME_SIZE];
+	char *sep;
+	int ret = -ENOENT;
+	FILE *fp;
+
+	fp = fopen(MTD_RESOLVE_CACHE_FILE, "r");
+	if (!fp)
+		return -ENOENT;
+
+	while (fgets(line, sizeof(line), fp)) {
+		line[strcspn(line, "\n")] = '\0';
+		sep = strrchr(line, ' ');
+		if (!sep)
+			continue;
+		*sep = '\0';
+		if (strcmp(line, name))
+			continue;
+		if (strlen(sep + 1) >= MTD_DEV_NAME_SIZE)
+			break;
+		strcpy(dev, sep + 1);
+		if (!mtd_read_name(dev, cur, sizeof(cur)) && !strcmp(cur, name))
+			ret = 0;
+		break;
+	}
+	fclose(fp);
+
+	return ret;
+}
+
+/*----------------------------------------------------------------------------
+ * @fn mtd_scan
+ *
+ * @brief Enumerate /sys/class/mtd, refresh the cache and resolve a name
+ * @params  name [IN] - Partition name
+ * 			dev [OUT] - Buffer of MTD_DEV_NAME_SIZE receiving mtdN
+ * @return  0 - Success
+ * 			-ENODEV - No partition with that name
+ * 			-errno - Failure
+ *--------------------------------------------------------------------------*/
+static int mtd_scan(const char *name, char *dev)
+{
+	char tmp[] = MTD_RESOLVE_CACHE_FILE ".XXXXXX";
+	char cur[MTD_NAME_SIZE];
+	struct dirent *de;
+	FILE *cache = NULL;
+	int ret = -ENODEV;
+	size_t len;
+	DIR *dir;
+	int fd;
+
+	dir = opendir(MTD_SYSFS_CLASS_DIR);
+	if (!dir)
+		return -errno;
+
+	/* The cache is an optimization only, failing to write it is fine */
+	if (!mkdir(MTD_RESOLVE_CACHE_DIR, 0755) || errno == EEXIST) {
+		fd = mkstemp(tmp);
+		if (fd >= 0) {
+			fchmod(fd, 0644);
+			cache = fdopen(fd, "w");
+		}
+	}
+
+	while ((de = readdir(dir)) != NULL) {
+		len = strlen(de->d_name);
+		/* Skip the mtdNro read-only aliases */
+		if (strncmp(de->d_name, "mtd", 3) || len >= MTD_DEV_NAME_SIZE ||
+		    !strcmp(de->d_name + len - 2, "ro"))
+			continue;
+		if (mtd_read_name(de->d_name, cur, sizeof(cur)))
+			continue;
+		if (cache)
+			fprintf(cache, "%s %s\n", cur, de->d_name);
+		if (ret && !strcmp(cur, name)) {
+			strcpy(dev, de->d_name);
+			ret = 0;
+		}
+	}
+	closedir(dir);
+
+	if (cache) {
+		if (fclose(cache) || rename(tmp, MTD_RESOLVE_CACHE_FILE))
+			unlink(tmp);
+	}
+
+	return ret;
+}
+
+/*----------------------------------------------------------------------------
+ * @fn mtd_resolve
+ *
+ * @brief Resolve an MTD partition name to its device node
+ * @params  name [IN] - Partition name, or a path starting with '/'
+ * 			path [OUT] - Buffer receiving the device node path
+ * 			len [IN] - Size of path buffer
+ * @return  0 - Success
+ * 			-errno - Failure
+ *--------------------------------------------------------------------------*/
+int mtd_resolve(const char *name, char *path, size_t len)
+{
+	char dev[MTD_DEV_NAME_SIZE];
+	int ret;
+
+	if (name[0] == '/') {
+		ret = snprintf(path, len, "%s", name);
+	} else {
+		ret = mtd_cache_lookup(name, dev);
+		if (ret < 0)
+			ret = mtd_scan(name, dev);
+		if (ret < 0)
+			return ret;
+		ret = snprintf(path, len, "/dev/%s", dev);
+	}
+
+	if (ret < 0 || (size_t)ret >= len)
+		return -ENAMETOOLONG;
+
+	return 0;
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2021 Ampere Computing LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * MTD partition name to device node resolver shared by the flash utilities.
+ */
+
+#ifndef MTD_RESOLVE_H
+#define MTD_RESOLVE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MTD_SYSFS_CLASS_DIR	"/sys/class/mtd"
+#define MTD_RESOLVE_CACHE_DIR	"/run/ampere-flash"
+#define MTD_RESOLVE_CACHE_FILE	MTD_RESOLVE_CACHE_DIR "/mtd-names"
+
+/*
+ * Resolve an MTD partition name (e.g. "pnor") to its device node
+ * (e.g. "/dev/mtd5"). Anything starting with '/' is taken as a path and
+ * returned unchanged. Returns 0 on success or a negative errno value.
+ */
+int mtd_resolve(const char *name, char *path, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MTD_RESOLVE_H */
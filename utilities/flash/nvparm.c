@@ -17,6 +17,9 @@
  *  - Program individual NVPARAM entry
  *  - Program a full NVPARAM based on the output of nvgen command
  *  - Clear NVPARAM area
+ *  - Delta apply a NVPARAM blob, rewriting only the changed erase blocks
+ *  - Get and set NVPARAMs by name through the compiled NVPARAM layout
+ *  - Optionally stage every block update in an A/B shadow block first
  */
 
 #include <errno.h>
@@ -31,28 +34,24 @@
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
 #include <limits.h>
 #include <dirent.h>
 
-typedef unsigned char uint8_t;
-typedef unsigned int uint32_t;
+#include "flash_progress.h"
+#include "libnvparam.h"
+#include "nvparam_layout.h"
+
 #define PERCENTAGE(x, total)    (((x) * 100) / (total))
 #define KB(x)                   ((x) / 1024)
 
-/* size of read/write buffer */
-#define BUFSIZE                 (10 * 1024)
-
 /* error levels */
 #define LOG_NORMAL              1
 #define LOG_ERROR               2
 
-#define PROC_MTD_INFO           "/proc/mtd"
-#define HOST_SPI_FLASH_MTD_NAME "\"pnor\""
-#define MTD_DEV_SIZE            20
-
 /* Option string of this application */
-#define OPTION_STRING	"cd:ef:hlo:rs:"
+#define OPTION_STRING	"a:cd:ef:hlo:rs:u:"
 enum {
 	OPTION_C = 0,
 	OPTION_D,
@@ -63,25 +62,32 @@ enum {
 	OPTION_S,
 	OPTION_E,
 	OPTION_L,
+	OPTION_U,
+	OPTION_N,
+	OPTION_A,
 	MAX_OPTIONS,
 };
 
-/*
- * According to Altra Interface Firmware Requirement,
- * size of NVPARAM partitions is 64KB.
- */
-#define NVPARAM_PARTITION_SIZE	(64 *1024)
-struct nvparam_entry {
-	uint32_t param1;
-	uint32_t acl_rd:8;
-	uint32_t acl_wr:7;
-	uint32_t valid:1;
-	uint32_t crc16:16;
-} __attribute__((__packed__));
-
-struct mtd_info_user mtd;
-struct stat filestat;
-struct erase_info_user erase;
+/* Long-only options resolving NVPARAMs by name */
+#define OPTION_GET		0x100
+#define OPTION_SET		0x101
+#define OPTION_PROGRESS		0x102
+#define OPTION_PROGRESS_FD	0x103
+
+/* One --get NAME or --set NAME=VALUE request */
+struct named_op {
+	const struct nvparam_layout_entry *param;
+	int set;
+	uint32_t value;
+	int done;
+};
+
+static struct nvparam_dev nvdev = { .flash = { .fd = -1 } };
+static struct stat filestat;
+static struct named_op *named_ops;
+static int named_op_count;
+/* Rate limit of the progress output, JSON lines when its fd is set */
+static struct flash_progress progress = { .fd = -1 };
 
 /*----------------------------------------------------------------------------
  * @fn log_printf
@@ -123,7 +129,7 @@ static int validate_input_file(int fil_fd, char *filename)
 	}
 
 	/* Checking file size whether the device will accumulate or not? */
-	if ((unsigned)filestat.st_size > mtd.size) {
+	if ((unsigned)filestat.st_size > nvdev.flash.mtd.size) {
 		log_printf(LOG_ERROR, "%s won't fit into SPI NOR partition!\n",
 			filename);
 		ret = -1;
@@ -146,60 +152,93 @@ static int validate_input_offset(ulong offset)
 {
 	int ret = 0;
 
-	if (offset > mtd.size) {
+	if (offset > nvdev.flash.mtd.size) {
 		log_printf(LOG_ERROR, "offset:0x%x not with-in range "
-			"of mtd partition size:0x%x\n", offset, mtd.size);
+			"of mtd partition size:0x%x\n", offset, nvdev.flash.mtd.size);
 		ret = -1;
 	}
 
-	if ((offset % mtd.erasesize) != 0) {
+	if ((offset % nvdev.flash.mtd.erasesize) != 0) {
 		log_printf(LOG_ERROR, "offset:0x%x is not a sector boundary\n"
 			"It needs to be multiples of erasesize:0x%x\n",
-			offset, mtd.erasesize);
+			offset, nvdev.flash.mtd.erasesize);
 		ret = -1;
 	}
 
 	return ret;
 }
 
+/*----------------------------------------------------------------------------
+ * @fn flash_progress
+ *
+ * @brief Print the progress reported by the MTD flash engine
+ * @params  flash [IN] - Flash handle
+ * 			stage [IN] - Erase, program or verify
+ * 			done [IN] - Bytes processed so far
+ * 			total [IN] - Bytes to process
+ * 			priv [IN] - Rate limit state
+ *--------------------------------------------------------------------------*/
+static void flash_progress(const struct mtd_flash *flash,
+			   enum mtd_flash_stage stage, uint64_t done,
+			   uint64_t total, void *priv)
+{
+	static const char *const stage_name[] = {
+		[MTD_FLASH_ERASE] = "Erasing blocks",
+		[MTD_FLASH_PROGRAM] = "Writing data",
+		[MTD_FLASH_VERIFY] = "Verifying data",
+		[MTD_FLASH_READ] = "Reading data",
+	};
+	unsigned long long percent = total ? PERCENTAGE(done, total) : 100;
+
+	if (!flash_progress_due(priv, mtd_flash_stage_name(stage), done, total))
+		return;
+
+	if (stage == MTD_FLASH_ERASE)
+		log_printf(LOG_NORMAL, "\r%s: %llu/%llu (%llu%%)",
+			stage_name[stage],
+			(unsigned long long) (done / flash->mtd.erasesize),
+			(unsigned long long) (total / flash->mtd.erasesize),
+			percent);
+	else
+		log_printf(LOG_NORMAL, "\r%s: %lluk/%lluk (%llu%%)",
+			stage_name[stage], (unsigned long long) KB(done),
+			(unsigned long long) KB(total), percent);
+	if (done == total)
+		log_printf(LOG_NORMAL, "\n");
+}
+
+/*----------------------------------------------------------------------------
+ * @fn flash_progress_start
+ *
+ * @brief Report the progress of the next engine call as text or JSON
+ *--------------------------------------------------------------------------*/
+static void flash_progress_start(void)
+{
+	mtd_flash_set_progress(&nvdev.flash, progress.fd >= 0 ?
+			flash_progress_json_cb : flash_progress, &progress);
+}
+
 /*----------------------------------------------------------------------------
  * @fn flash_erase
  *
  * @brief Erase the content of given SPI NOR device, at given offset and length.
- * @params  dev_fd [IN] - The file descriptor of SPI NOR device to be erased
- * 			offset [IN] - The offset in SPI NOR device to begin erasing
+ * @params  offset [IN] - The offset in SPI NOR device to begin erasing
  * 			length [IN] - Number of bytes will be erased
  * @return  0 - Success
  * 			-1 - Failure
  *--------------------------------------------------------------------------*/
-static int flash_erase(int dev_fd, ulong offset, ulong length)
+static int flash_erase(ulong offset, ulong length)
 {
-	int i, blocks;
-
-	erase.start = offset;
-	erase.length = (length + mtd.erasesize - 1) / mtd.erasesize;
-	erase.length *= mtd.erasesize;
-
-	blocks = erase.length / mtd.erasesize;
-	erase.length = mtd.erasesize;
-
-	/* Erasing required flash sector based on input file size */
-	for (i = 1; i <= blocks; i++) {
-		log_printf(LOG_NORMAL, "\rErasing blocks: %d/%d (%d%%)",
-			i, blocks, PERCENTAGE(i, blocks));
-		if (ioctl(dev_fd, MEMERASE, &erase) < 0) {
-			log_printf(LOG_ERROR,
-				"Error While erasing blocks 0x%.8x-0x%.8x: %m\n",
-				(unsigned int) erase.start,
-				(unsigned int) (erase.start + erase.length));
-			return -1;
-		}
-		erase.start += mtd.erasesize;
+	flash_progress_start();
+	errno = -mtd_flash_erase(&nvdev.flash, offset, length);
+	mtd_flash_set_progress(&nvdev.flash, NULL, NULL);
+	if (errno) {
+		log_printf(LOG_ERROR,
+			"\nError While erasing blocks 0x%.8lx-0x%.8lx: %m\n",
+			offset, offset + length);
+		return -1;
 	}
 
-	log_printf(LOG_NORMAL, "\rErasing blocks: %d/%d (100%%)\n",
-		blocks, blocks);
-
 	return 0;
 }
 
@@ -226,277 +265,284 @@ static int flash_open(char *filename, int flags)
 }
 
 /*----------------------------------------------------------------------------
- * @fn flash_read
+ * @fn flash_write
  *
- * @brief Read content from file
- * @params  fd [IN] - File descriptor of file to read from
- * 			filename [IN] - Name of file to be read
- * 			buf [OUT] - Buffer contains read data
- * 			count [IN] - Size to read in bytes
+ * @brief Write content of input file to flash at desired offset
+ * @params  fil_fd [IN] - File descriptor of input file
+ * 			offset [IN] - Location in flash to write
+ * 			filename [IN] - String of input file name
  * @return  0 - Success
  * 			-1 - Failure
  *--------------------------------------------------------------------------*/
-static int flash_read(int fd, const char *filename, void *buf, size_t count)
+static int flash_write(int fil_fd, ulong offset, char *filename)
 {
-	size_t result;
-	int ret = 0;
-
-	result = read(fd, buf, count);
-
-	if (count != result) {
-		printf("\n");
-		if ((signed)result < 0) {
-			log_printf(LOG_ERROR, "While reading data from"
-				"%s: %m\n", filename);
-			ret = -1;
-		}
-		log_printf(LOG_ERROR, "Short read count returned while reading"
-			"from %s\n", filename);
-		ret = -1;
+	flash_progress_start();
+	errno = -mtd_flash_program(&nvdev.flash, fil_fd, offset,
+			filestat.st_size);
+	mtd_flash_set_progress(&nvdev.flash, NULL, NULL);
+	if (errno) {
+		log_printf(LOG_ERROR, "\nWhile writing %s to 0x%.8lx on %s: %m\n",
+			filename, offset, nvdev.flash.path);
+		return -1;
 	}
-	return ret;
+
+	return 0;
 }
 
 /*----------------------------------------------------------------------------
- * @fn flash_rewind
+ * @fn flash_verify
  *
- * @brief Rewind pointer to specified offset
- * @params  fd [IN] - File descriptor of file to seek
- * 			offset [IN] - Desired location in file
- * 			filename [IN] - Name of file
- * @return  0 - Success
+ * @brief Compare input file with flashed content
+ * @params  fil_fd [IN] - File descriptor of input file
+ * 			offset [IN] - Location in flash to start comparing
+ * 			filename [IN] - String of input file name
+ * @return  0 - Match
  * 			-1 - Failure
  *--------------------------------------------------------------------------*/
-static int flash_rewind(int fd, unsigned long offset, const char *filename)
+static int flash_verify(int fil_fd, ulong offset, char *filename)
 {
-	if (lseek(fd, offset, SEEK_SET) < 0) {
-		log_printf(LOG_ERROR, "While seeking to start of %s: %m\n",
-			filename);
+	uint64_t mismatch = 0;
+
+	flash_progress_start();
+	errno = -mtd_flash_verify(&nvdev.flash, fil_fd, offset,
+			filestat.st_size, &mismatch);
+	mtd_flash_set_progress(&nvdev.flash, NULL, NULL);
+	if (errno == EBADMSG) {
+		log_printf(LOG_ERROR, "\nFile does not seem to match flash data. "
+			"First mismatch at 0x%.8llx-0x%.8llx\n",
+			(unsigned long long) mismatch,
+			(unsigned long long) (mismatch + nvdev.flash.bufsize));
 		return -1;
 	}
+	if (errno) {
+		log_printf(LOG_ERROR, "\nWhile verifying %s: %m\n", filename);
+		return -1;
+	}
+
+	log_printf(LOG_NORMAL, "Verified flash content %lu bytes, Success.\n",
+		filestat.st_size);
+
 	return 0;
 }
 
 /*----------------------------------------------------------------------------
- * @fn flash_write
+ * @fn nvparam_delta_apply
  *
- * @brief Write content of input file to flash at desired offset
- * @params  dev_fd [IN] - File descriptor of flash
- * 			fil_fd [IN] - File descriptor of input file
- * 			offset [IN] - Location in flash to write
- * 			argv1_ptr [IN] - String of input file name
- * 			argv2_ptr [IN] - String of input flash offset
+ * @brief Apply a NVPARAM blob by comparing it entry by entry with the current
+ * flash content. Only the erase blocks which contain changed entries are
+ * erased, programmed and verified.
+ * @params  fil_fd [IN] - File descriptor of input file
+ * 			offset [IN] - Location in flash to apply the blob
+ * 			filename [IN] - String of input file name
  * @return  0 - Success
  * 			-1 - Failure
  *--------------------------------------------------------------------------*/
-static int flash_write(int dev_fd, int fil_fd, ulong offset, char *argv1_ptr,
-			 char *argv2_ptr)
+static int nvparam_delta_apply(int fil_fd, ulong offset, char *filename)
 {
-	ssize_t result, size, written;
-	unsigned char src[BUFSIZE];
-	int i, tmp = 0;
-	int ret = 0;
-
-	log_printf(LOG_NORMAL, "Writing data: 0k/%luk (0%%)",
-		KB(filestat.st_size));
+	uint entries_per_block = nvdev.flash.mtd.erasesize / sizeof(struct nvparam_entry);
+	struct nvparam_entry cur[entries_per_block], new[entries_per_block];
+	ulong block_base, size, chunk;
+	uint index, block_changes;
+	int blocks, changed_blocks = 0, changed_entries = 0, i;
 
 	size = filestat.st_size;
-	i = BUFSIZE;
-	written = 0;
+	blocks = (size + nvdev.flash.mtd.erasesize - 1) / nvdev.flash.mtd.erasesize;
+	block_base = offset;
+
+	for (i = 1; i <= blocks; i++, block_base += nvdev.flash.mtd.erasesize) {
+		if (progress.fd >= 0)
+			flash_progress_json(&progress, nvdev.flash.path, "compare",
+				(uint64_t) i * nvdev.flash.mtd.erasesize,
+				(uint64_t) blocks * nvdev.flash.mtd.erasesize);
+		else if (flash_progress_due(&progress, "compare", i, blocks))
+			log_printf(LOG_NORMAL, "\rComparing blocks: %d/%d (%d%%)",
+				i, blocks, PERCENTAGE(i, blocks));
 
-	if (offset) {
-		tmp = flash_rewind(dev_fd, offset, argv2_ptr);
-		if (tmp < 0) {
-			ret = -1;
-			goto out;
+		/*
+		 * A partial last block is padded with 0xFF, which is what a full
+		 * erase and write of the blob would leave behind.
+		 */
+		chunk = size < nvdev.flash.mtd.erasesize ? size : nvdev.flash.mtd.erasesize;
+		memset(new, 0xFF, sizeof(new));
+		if (pread(fil_fd, new, chunk, filestat.st_size - size) !=
+				(ssize_t) chunk) {
+			log_printf(LOG_ERROR, "\nShort read count returned while "
+				"reading from %s\n", filename);
+			return -1;
 		}
-	}
-
-	/* Writing file content into flash partition */
-	while (size) {
-		if (size < BUFSIZE)
-			i = size;
+		size -= chunk;
 
-		log_printf(LOG_NORMAL, "\rWriting data: %dk/%luk (%lu%%)",
-			KB(written + i), KB(filestat.st_size),
-			PERCENTAGE(written + i, filestat.st_size));
-
-		/* read from filename */
-		tmp = flash_read(fil_fd, argv1_ptr, src, i);
-		if (tmp < 0) {
-			ret = -1;
-			goto out;
+		errno = -nvparam_read_block(&nvdev, block_base, cur);
+		if (errno) {
+			log_printf(LOG_ERROR, "Failed to read block at 0x%lx: %m\n",
+				block_base);
+			return -1;
 		}
 
-		/* write to device */
-		result = write(dev_fd, src, i);
-		if (i != result) {
+		if (!memcmp(cur, new, sizeof(new)))
+			continue;
+
+		if (progress.fd < 0)
 			printf("\n");
-			if (result < 0) {
-				log_printf(LOG_ERROR, "While writing data to"
-					"0x%.8x-0x%.8x on %s: %m\n",
-					written, written + i, argv2_ptr);
-				ret = -1;
-				goto out;
-			}
+		block_changes = 0;
+		for (index = 0; index < entries_per_block; index++) {
+			if (!memcmp(&cur[index], &new[index],
+					sizeof(struct nvparam_entry)))
+				continue;
+			log_printf(LOG_NORMAL, "NVPARAM at 0x%lx: 0x%08x -> 0x%08x "
+				"(valid %d -> %d)\n",
+				block_base + (index * sizeof(struct nvparam_entry)),
+				cur[index].param1, new[index].param1,
+				cur[index].valid, new[index].valid);
+			block_changes++;
+		}
 
-			log_printf(LOG_ERROR, "Short write count returned while"
-				"writing to x%.8x-0x%.8x on %s: %d/%lu bytes"
-				" written to flash\n", written, written + i,
-				argv2_ptr, written + result, filestat.st_size);
-			ret = -1;
-			goto out;
+		errno = -nvparam_commit_block(&nvdev, block_base, new);
+		if (errno) {
+			log_printf(LOG_ERROR, "Failed to rewrite block at 0x%lx: %m\n",
+				block_base);
+			return -1;
 		}
-		written += i;
-		size -= i;
+
+		changed_entries += block_changes;
+		changed_blocks++;
 	}
 
-	log_printf(LOG_NORMAL,
-		"\rWriting data: %luk/%luk (100%%)\n",
-		KB(filestat.st_size), KB(filestat.st_size));
-out:
-	return ret;
+	if (progress.fd < 0)
+		log_printf(LOG_NORMAL, "\rComparing blocks: %d/%d (100%%)\n",
+			blocks, blocks);
+	log_printf(LOG_NORMAL, "Updated %d changed entries in %d/%d "
+		"erase block(s)\n", changed_entries, changed_blocks, blocks);
+
+	return 0;
 }
 
 /*----------------------------------------------------------------------------
- * @fn flash_verify
+ * @fn named_op_add
  *
- * @brief Compare input file with flashed content
- * @params  dev_fd [IN] - File descriptor of flash
- * 			fil_fd [IN] - File descriptor of input file
- * 			offset [IN] - Location in flash to start comparing
- * 			argv1_ptr [IN] - String of input file name
- * 			argv2_ptr [IN] - String of input flash offset
- * @return  0 - Match
+ * @brief Resolve a --get NAME or --set NAME=VALUE argument against the
+ * NVPARAM layout and queue it
+ * @params  arg [IN] - Option argument
+ * 			set [IN] - 1 for --set, 0 for --get
+ * @return  0 - Success
  * 			-1 - Failure
  *--------------------------------------------------------------------------*/
-static int flash_verify(int dev_fd, int fil_fd, ulong offset, char *argv1_ptr,
-			char *argv2_ptr)
+static int named_op_add(char *arg, int set)
 {
-	unsigned char src[BUFSIZE], dest[BUFSIZE];
-	ssize_t size, written;
-	int i, tmp = 0;
-	int ret = 0;
-
-	/*
-	 * After flash write operation file pointer and device pointer
-	 * are moved to other location based upon the size. For verify
-	 * operation we need to move back the file poitner and device
-	 * pointer to original location
-	 */
-	tmp = flash_rewind(fil_fd, 0x0, argv1_ptr);
-	if (tmp < 0) {
-		ret = -1;
-		goto out;
+	const struct nvparam_layout_entry *param;
+	struct named_op *op = &named_ops[named_op_count];
+	unsigned long value = 0, max = UINT_MAX;
+	char *eq = NULL, *end;
+
+	if (set) {
+		eq = strchr(arg, '=');
+		if (!eq || eq[1] == '\0') {
+			log_printf(LOG_ERROR, "--set expects NAME=VALUE, got %s\n", arg);
+			return -1;
+		}
+		*eq = '\0';
 	}
 
-	tmp = flash_rewind(dev_fd, offset, argv2_ptr);
-	if (tmp < 0) {
-		ret = -1;
-		goto out;
+	param = nvparam_layout_find(arg);
+	if (!param) {
+		log_printf(LOG_ERROR, "Unknown NVPARAM %s\n", arg);
+		return -1;
 	}
 
-	size = filestat.st_size;
-	i = BUFSIZE;
-	written = 0;
-
-	log_printf(LOG_NORMAL, "Verifying data: 0k/%luk (0%%)",
-		KB(filestat.st_size));
-
-	/* Verifying flash sector content with input file */
-	while (size) {
-		if (size < BUFSIZE)
-			i = size;
-
-		log_printf(LOG_NORMAL,
-			"\rVerifying data: %dk/%luk (%lu%%)", KB(written + i),
-			KB(filestat.st_size),
-			PERCENTAGE(written + i, filestat.st_size));
-
-		/* read from filename */
-		tmp = flash_read(fil_fd, argv1_ptr, src, i);
-		if (tmp < 0) {
-			ret = -1;
-			goto out;
-		}
-
-		/* read from device */
-		tmp = flash_read(dev_fd, argv2_ptr, dest, i);
-		if (tmp < 0) {
-			ret = -1;
-			goto out;
+	if (set) {
+		errno = 0;
+		value = strtoul(eq + 1, &end, 0);
+		switch (param->type) {
+		case NVPARAM_TYPE_U8:
+			max = UCHAR_MAX;
+			break;
+		case NVPARAM_TYPE_U16:
+			max = USHRT_MAX;
+			break;
+		case NVPARAM_TYPE_BOOL:
+			max = 1;
+			break;
+		default:
+			break;
 		}
-
-		/* compare buffers */
-		if (memcmp(src, dest, i)) {
-			log_printf(LOG_ERROR, "File does not seem to match"
-				"flash data. First mismatch at 0x%.8x-0x%.8x\n",
-				written, written + i);
-			ret = -1;
-			goto out;
+		if (errno || *end != '\0' || value > max) {
+			log_printf(LOG_ERROR, "Invalid value %s for %s (max 0x%lx)\n",
+				eq + 1, arg, max);
+			return -1;
 		}
-		written += i;
-		size -= i;
 	}
 
-	log_printf(LOG_NORMAL,
-		"\rVerifying data: %luk/%luk (100%%)\n",
-		KB(filestat.st_size), KB(filestat.st_size));
-
-	log_printf(LOG_NORMAL, "Verified flash content %lu bytes, Success.\n",
-		filestat.st_size);
-
-out:
-	return ret;
-}
-
-/*----------------------------------------------------------------------------
- * @fn crc16
- *
- * @brief Calculate CRC16
- * @params  ptr [IN] - Input buffer to calculate CRC16 on
- * 			count [IN] - Number of bytes to calculate CRC16
- * @return  CRC16 value
- *--------------------------------------------------------------------------*/
-static int crc16(uint8_t *ptr, int count)
-{
-	int crc = 0;
-	int i;
-
-	while (--count >= 0) {
-		crc = crc ^ (int)*ptr++ << 8;
-		for (i = 0; i < 8; ++i) {
-			if (crc & 0x8000)
-				crc = crc << 1 ^ 0x1021;
-			else
-				crc = crc << 1;
-		}
-	}
+	op->param = param;
+	op->set = set;
+	op->value = value;
+	op->done = 0;
+	named_op_count++;
 
-	return crc & 0xffff;
+	return 0;
 }
 
 /*----------------------------------------------------------------------------
- * @fn nvparam_get
+ * @fn named_ops_apply
  *
- * @brief Read one erase block of NVPARAM
- * @params  mtd_fd [IN] - File descriptor of SPI NOR device contains NVPARAM partition
- * 			nvparam_base [IN] - Base offset of NVPARAM partition
- * 			nvparam_blob [OUT] - Buffer of read NVPARAM
+ * @brief Run the queued --get/--set requests. Requests are grouped by erase
+ * block so that each block is read once and written at most once.
  * @return  0 - Success
  * 			-1 - Failure
  *--------------------------------------------------------------------------*/
-static int nvparam_get(int mtd_fd, ulong nvparam_base, void *nvparam_blob)
+static int named_ops_apply(void)
 {
-	int ret = -1;
+	struct nvparam_entry blob[nvdev.flash.mtd.erasesize / sizeof(struct nvparam_entry)];
+	struct nvparam_entry *entry;
+	ulong base;
+	int i, j, dirty;
+
+	for (i = 0; i < named_op_count; i++) {
+		if (named_ops[i].done)
+			continue;
+
+		errno = -nvparam_block_base(&nvdev, named_ops[i].param->offset,
+					   &base);
+		if (!errno)
+			errno = -nvparam_read_block(&nvdev, base, (void *) blob);
+		if (errno) {
+			log_printf(LOG_ERROR, "Failed to read %s: %m\n",
+				named_ops[i].param->name);
+			return -1;
+		}
 
-	ret = flash_rewind(mtd_fd, nvparam_base, NULL);
-	if (ret < 0)
-		return ret;
+		dirty = 0;
+		for (j = i; j < named_op_count; j++) {
+			if (named_ops[j].done ||
+			    named_ops[j].param->offset - base >= nvdev.flash.mtd.erasesize)
+				continue;
+
+			entry = &blob[(named_ops[j].param->offset - base) /
+				sizeof(struct nvparam_entry)];
+			if (named_ops[j].set) {
+				nvparam_entry_set(entry, named_ops[j].value);
+				dirty = 1;
+			} else if (entry->valid && nvparam_entry_crc_ok(entry)) {
+				log_printf(LOG_NORMAL, "%s=0x%x\n",
+					named_ops[j].param->name, entry->param1);
+			} else {
+				log_printf(LOG_NORMAL, "%s=0x%x (default)\n",
+					named_ops[j].param->name, named_ops[j].param->def);
+			}
+			named_ops[j].done = 1;
+		}
 
-	ret = flash_read(mtd_fd, NULL, nvparam_blob, mtd.erasesize);
+		if (!dirty)
+			continue;
 
-	return ret;
+		errno = -nvparam_commit_block(&nvdev, base, (void *) blob);
+		if (errno) {
+			log_printf(LOG_ERROR, "Failed to write NVPARAM block 0x%lx: %m\n",
+				base);
+			return -1;
+		}
+	}
+
+	return 0;
 }
 
 /*----------------------------------------------------------------------------
@@ -522,42 +568,115 @@ static void help(char *name)
 			"\n\tList out all the valid nvparam settings on a NVPARAM partition at <NVPARAM base SPI offset>\n"
 			"%s -e -o <SPI offset>: "
 			"Erase a particular NVPARAM at host SPI NOR offset <SPI offset>\n"
+			"%s -u <file> -o <SPI offset>: "
+			"Delta apply binary <file> to host SPI NOR at offset <SPI offset>."
+			"\n\tOnly the erase blocks with changed NVPARAM entries are rewritten.\n"
+			"%s --get <name> [--get <name> ...]: "
+			"Read NVPARAMs by name from the NVPARAM layout\n"
+			"%s --set <name>=<value> [--set <name>=<value> ...]: "
+			"Set NVPARAMs by name from the NVPARAM layout."
+			"\n\t--get and --set can be batched, each erase block is written once.\n"
+			"%s -a <shadow SPI offset> ...: "
+			"Power-fail-safe mode for -s, -e, -u and --set."
+			"\n\tEach block update is staged in the two erase blocks at <shadow SPI offset>"
+			"\n\tand committed there before the live block is rewritten. An interrupted"
+			"\n\tupdate is recovered from the shadow copy on the next run. Each update"
+			"\n\tcosts one extra erase of the shadow block.\n"
+			"%s --progress=json [--progress-fd=<fd>] ...: "
+			"Report the progress of -f, -c and -u as JSON lines"
+			"\n\ton <fd> (default 2), at most 4 per second, ending with a result line.\n"
 			"%s -h: "
-			"Print this help\n", name, name, name, name, name, name, name, name);
+			"Print this help\n", name, name, name, name, name, name, name, name,
+			name, name, name, name, name);
 }
 
 int main(int argc, char *argv[])
 {
-	static int dev_fd = -1, fil_fd = -1;
+	static int fil_fd = -1;
 	int ret = 0;
-	int nMTDDeviceNumber= -1;
 	unsigned long offset = ULONG_MAX, value = ULONG_MAX;
-	char *argv_dev_ptr;
-	char mtd_dev[MTD_DEV_SIZE];
-	char temp_mtd[4] = {0}, *temp;
-	FILE *proc_fp;
-	char proc_buf[80];
 	int argflag;
-	int options_used[MAX_OPTIONS] = { 0, 0, 0, 0, 0, 0, 0, 0, 0 }; /* c, d, f, h, o, r, s, l, e */
+	int options_used[MAX_OPTIONS] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 }; /* c, d, f, h, o, r, s, e, l, u, n, a */
+	static const struct option long_options[] = {
+		{ "get", required_argument, 0, OPTION_GET },
+		{ "set", required_argument, 0, OPTION_SET },
+		{ "progress", required_argument, 0, OPTION_PROGRESS },
+		{ "progress-fd", required_argument, 0, OPTION_PROGRESS_FD },
+		{ 0, 0, 0, 0 },
+	};
 	char *filepath = NULL;
 	char *input_offset = NULL;
 	char *input_value = NULL;
+	unsigned long shadow_offset = ULONG_MAX;
+	int progress_json = 0, progress_fd = STDERR_FILENO;
+	struct timespec start, end;
+	char *endp;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
 	if (argc == 1) {
 		help(argv[0]);
 		goto exit_free;
 	}
-	while ((argflag = getopt(argc, (char **)argv, OPTION_STRING)) != -1) {
+
+	named_ops = calloc(argc, sizeof(struct named_op));
+	if (!named_ops) {
+		log_printf(LOG_ERROR, "malloc failure\n");
+		ret = 1;
+		goto exit_free;
+	}
+
+	while ((argflag = getopt_long(argc, (char **)argv, OPTION_STRING,
+			long_options, NULL)) != -1) {
 		switch (argflag) {
+		case OPTION_GET:
+		case OPTION_SET:
+			options_used[OPTION_N] = 1;
+			if (named_op_add(optarg, argflag == OPTION_SET) < 0) {
+				ret = 1;
+				goto exit_free;
+			}
+			break;
+		case OPTION_PROGRESS:
+			if (strcmp(optarg, "json") && strcmp(optarg, "text")) {
+				log_printf(LOG_ERROR, "Unknown progress format: %s\n",
+					optarg);
+				ret = 1;
+				goto exit_free;
+			}
+			progress_json = !strcmp(optarg, "json");
+			break;
+		case OPTION_PROGRESS_FD:
+			progress_fd = strtol(optarg, &endp, 10);
+			if (*endp || progress_fd < 0 ||
+					fcntl(progress_fd, F_GETFD) < 0) {
+				log_printf(LOG_ERROR, "Invalid progress fd: %s\n", optarg);
+				ret = 1;
+				goto exit_free;
+			}
+			break;
+		case 'a':
+			options_used[OPTION_A] = 1;
+			errno = 0;
+			shadow_offset = strtoul(optarg, NULL, 16);
+			if (errno) {
+				log_printf(LOG_ERROR, "Input %s is %s\n", optarg, strerror(errno));
+				ret = 1;
+				goto exit_free;
+			}
+			break;
 		case 'c':
 			options_used[OPTION_C] = 1;
 			break;
 		case 'd':
 		case 'f':
+		case 'u':
 			if (argflag == 'd')
 				options_used[OPTION_D] = 1;
-			else
+			else if (argflag == 'f')
 				options_used[OPTION_F] = 1;
+			else
+				options_used[OPTION_U] = 1;
 			if (filepath) {
 				free(filepath);
 				filepath = NULL;
@@ -606,6 +725,7 @@ int main(int argc, char *argv[])
 			break;
 		case 'h':
 			options_used[OPTION_H] = 1;
+			/* fall through */
 		default:
 			help(argv[0]);
 			goto exit_free;
@@ -614,7 +734,19 @@ int main(int argc, char *argv[])
 	}
 
 	/* Sanitize user inputs */
-	if (!options_used[OPTION_O]) {
+	if (options_used[OPTION_N] && (options_used[OPTION_C]
+			|| options_used[OPTION_D] || options_used[OPTION_F]
+			|| options_used[OPTION_R] || options_used[OPTION_S]
+			|| options_used[OPTION_L] || options_used[OPTION_E]
+			|| options_used[OPTION_U] || options_used[OPTION_O])) {
+		log_printf(LOG_ERROR,
+				"Options --get and --set can't be mixed with offset based options.\n");
+		help(argv[0]);
+		ret = 1;
+		goto exit_free;
+	}
+
+	if (!options_used[OPTION_O] && !options_used[OPTION_N]) {
 		log_printf(LOG_ERROR, "SPI offset must be specified\n");
 		help(argv[0]);
 		ret = 1;
@@ -641,9 +773,16 @@ int main(int argc, char *argv[])
 			|| (options_used[OPTION_F] && options_used[OPTION_E])
 			|| (options_used[OPTION_R] && options_used[OPTION_L])
 			|| (options_used[OPTION_R] && options_used[OPTION_E])
-			|| (options_used[OPTION_L] && options_used[OPTION_E])) {
+			|| (options_used[OPTION_L] && options_used[OPTION_E])
+			|| (options_used[OPTION_U] && options_used[OPTION_C])
+			|| (options_used[OPTION_U] && options_used[OPTION_D])
+			|| (options_used[OPTION_U] && options_used[OPTION_F])
+			|| (options_used[OPTION_U] && options_used[OPTION_R])
+			|| (options_used[OPTION_U] && options_used[OPTION_S])
+			|| (options_used[OPTION_U] && options_used[OPTION_L])
+			|| (options_used[OPTION_U] && options_used[OPTION_E])) {
 		log_printf(LOG_ERROR,
-				"Options -c, -d, -f, -r, -s, -l, -e can't be mixed together.\n");
+				"Options -c, -d, -f, -r, -s, -l, -e, -u can't be mixed together.\n");
 		help(argv[0]);
 		ret = 1;
 		goto exit_free;
@@ -667,71 +806,55 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	flash_progress_init(&progress, progress_json ? progress_fd : -1);
+
 	/*
 	 * TODO: If the SPI-NOR device does not probed. Need to rescan HOST
 	 * SPI-NOR to probe the device
 	 */
 
-	/* Finding the MTD partition for host boot SPI chip */
-	if ((proc_fp = fopen(PROC_MTD_INFO, "r")) == NULL)
-	{
-		log_printf(LOG_ERROR, "Unable to open %s to get MTD info...\n", PROC_MTD_INFO);
+	/* Finding and opening the MTD partition for host boot SPI chip */
+	ret = nvparam_open(&nvdev);
+	if (ret < 0) {
+		errno = -ret;
+		log_printf(LOG_ERROR, "Unable to open HOST SPI / PNOR MTD "
+			"partition: %m\n");
+		ret = 1;
 		goto out;
 	}
 
-	while (fgets(proc_buf, sizeof(proc_buf), proc_fp) != NULL)
-	{
-		/* Try to find "HOST SPI" for BIOS flash */
-		if (strstr(proc_buf, HOST_SPI_FLASH_MTD_NAME))
-		{
-			temp  = strtok(proc_buf, ":");
-			if(temp == NULL)
-			{
-				log_printf(LOG_ERROR,"Error in finding the BIOS Partition \n");
-				fclose(proc_fp);
-				goto out;
-			}
-
-			memcpy((char *)&temp_mtd, (char *)&temp[3], (strlen(temp) - 3));
-			nMTDDeviceNumber = atoi(temp_mtd);
-			break;
+	if (options_used[OPTION_A]) {
+		ret = nvparam_enable_shadow(&nvdev, shadow_offset);
+		if (ret == -EUCLEAN) {
+			log_printf(LOG_ERROR, "Unable to recover the interrupted update "
+				"from the shadow blocks at 0x%lx: both copies are damaged\n",
+				shadow_offset);
+			ret = 1;
+			goto out;
+		}
+		if (ret < 0) {
+			errno = -ret;
+			log_printf(LOG_ERROR, "Unable to use shadow blocks at 0x%lx: %m\n",
+				shadow_offset);
+			ret = 1;
+			goto out;
 		}
-	}
-	fclose(proc_fp);
-
-	if (nMTDDeviceNumber == -1)
-	{
-		log_printf(LOG_ERROR,"Unable to find HOST SPI / PNOR  MTD partition...\n");
-		goto out;
-	}
-	ret= snprintf(&mtd_dev[0], MTD_DEV_SIZE, "/dev/mtd%d", nMTDDeviceNumber);
-	if(ret  >= MTD_DEV_SIZE || ret < 0)
-	{
-		log_printf(LOG_ERROR,"Buffer Overflow.\n");
-		goto out;
 	}
 
-	argv_dev_ptr = &mtd_dev[0];
-
-	dev_fd  = flash_open(argv_dev_ptr, O_SYNC | O_RDWR);
-	if (dev_fd < 0){
-		ret = 1;
+	/* Process user inputs */
+	if (options_used[OPTION_N]) {
+		if (named_ops_apply() < 0)
+			ret = 1;
 		goto out;
 	}
 
-	/* Get the MTD device info */
-	ret = ioctl(dev_fd, MEMGETINFO, &mtd);
-	if (ret < 0)
-		goto out;
-
-	/* Process user inputs */
 	if (options_used[OPTION_C]) {
 		if (validate_input_offset(offset) < 0) {
 			ret = 1;
 			goto out;
 		}
 
-		if (flash_erase(dev_fd, offset, NVPARAM_PARTITION_SIZE) < 0) {
+		if (flash_erase(offset, NVPARAM_PARTITION_SIZE) < 0) {
 			log_printf(LOG_ERROR, "Failed to erase\n");
 			ret = 1;
 			goto out;
@@ -739,15 +862,15 @@ int main(int argc, char *argv[])
 	}
 
 	if (options_used[OPTION_D]) {
-		struct nvparam_entry blob[mtd.erasesize / sizeof(struct nvparam_entry)];
-		ulong nvparam_base = (offset / mtd.erasesize) * mtd.erasesize;
+		struct nvparam_entry blob[nvdev.flash.mtd.erasesize / sizeof(struct nvparam_entry)];
+		ulong nvparam_base = (offset / nvdev.flash.mtd.erasesize) * nvdev.flash.mtd.erasesize;
 
 		if (validate_input_offset(offset) < 0) {
 			ret = 1;
 			goto out;
 		}
 
-		if (nvparam_get(dev_fd, nvparam_base, (void *) &blob) < 0) {
+		if (nvparam_read_block(&nvdev, nvparam_base, (void *) &blob) < 0) {
 			log_printf(LOG_ERROR, "Failed to read NVPARAM\n");
 			ret = 1;
 			goto out;
@@ -781,106 +904,89 @@ int main(int argc, char *argv[])
 			goto out;
 		}
 
-		if (flash_erase(dev_fd, offset, filestat.st_size) < 0) {
+		if (flash_erase(offset, filestat.st_size) < 0) {
 			log_printf(LOG_ERROR, "Failed to erase\n");
 			ret = 1;
 			goto out;
 		}
-		if (flash_write(dev_fd, fil_fd, offset, filepath, input_offset) < 0) {
+		if (flash_write(fil_fd, offset, filepath) < 0) {
 			ret = 1;
 			goto out;
 		}
-		if (flash_verify(dev_fd, fil_fd, offset, filepath, input_offset) < 0) {
+		if (flash_verify(fil_fd, offset, filepath) < 0) {
 			ret = 1;
 			goto out;
 		}
 	}
 
-	if (options_used[OPTION_S]) {
-		struct nvparam_entry blob[mtd.erasesize / sizeof(struct nvparam_entry)];
-		ulong nvparam_base = (offset / mtd.erasesize) * mtd.erasesize;
-		uint entry_no = (offset - nvparam_base) / sizeof(struct nvparam_entry);
-
-		if (nvparam_get(dev_fd, nvparam_base, (void *) &blob) < 0) {
-			log_printf(LOG_ERROR, "Failed to read NVPARAM\n");
+	if (options_used[OPTION_U]) {
+		fil_fd = flash_open(filepath, O_RDONLY);
+		if (fil_fd < 0) {
 			ret = 1;
 			goto out;
 		}
-
-		blob[entry_no].param1 = value;
-		/*
-		 * Set acl_rd, acl_wr and valid to all 1s as requirement of
-		 * host firmware team.
-		 */
-		blob[entry_no].acl_rd = 0xFF;
-		blob[entry_no].acl_wr = 0x7F;
-		blob[entry_no].valid = 1;
-		/*
-		 * Calculate NVPRAM entry CRC16. CRC16 is calculated on whole NVPARAM
-		 * entry with crc16 = 0
-		 */
-		blob[entry_no].crc16 = 0;
-		blob[entry_no].crc16 = crc16((uint8_t *) &blob[entry_no],
-				sizeof(struct nvparam_entry));
-
-		if (flash_erase(dev_fd, nvparam_base, sizeof(blob)) < 0) {
-			log_printf(LOG_ERROR, "Failed to erase\n");
+		if (validate_input_file(fil_fd, filepath) < 0) {
 			ret = 1;
 			goto out;
 		}
-
-		ret = flash_rewind(dev_fd, nvparam_base, NULL);
-		if (ret < 0) {
+		if (validate_input_offset(offset) < 0) {
 			ret = 1;
 			goto out;
 		}
-
-		ret = write(dev_fd, (void *)blob, sizeof(blob));
-		if (ret < 0) {
+		if (nvparam_delta_apply(fil_fd, offset, filepath) < 0) {
+			log_printf(LOG_ERROR, "Failed to apply NVPARAM delta\n");
 			ret = 1;
 			goto out;
 		}
 	}
 
-	if (options_used[OPTION_E]) {
-		struct nvparam_entry blob[mtd.erasesize / sizeof(struct nvparam_entry)];
-		ulong nvparam_base = (offset / mtd.erasesize) * mtd.erasesize;
+	if (options_used[OPTION_S]) {
+		struct nvparam_entry blob[nvdev.flash.mtd.erasesize / sizeof(struct nvparam_entry)];
+		ulong nvparam_base = (offset / nvdev.flash.mtd.erasesize) * nvdev.flash.mtd.erasesize;
 		uint entry_no = (offset - nvparam_base) / sizeof(struct nvparam_entry);
 
-		if (nvparam_get(dev_fd, nvparam_base, (void *) &blob) < 0) {
+		if (nvparam_read_block(&nvdev, nvparam_base, (void *) &blob) < 0) {
 			log_printf(LOG_ERROR, "Failed to read NVPARAM\n");
 			ret = 1;
 			goto out;
 		}
 
-		memset((void *) &blob[entry_no], 0xFF, sizeof(struct nvparam_entry));
+		nvparam_entry_set(&blob[entry_no], value);
 
-		if (flash_erase(dev_fd, nvparam_base, sizeof(blob)) < 0) {
-			log_printf(LOG_ERROR, "Failed to erase\n");
+		if (nvparam_commit_block(&nvdev, nvparam_base, (void *) blob) < 0) {
+			log_printf(LOG_ERROR, "Failed to write NVPARAM\n");
 			ret = 1;
 			goto out;
 		}
+	}
 
-		ret = flash_rewind(dev_fd, nvparam_base, NULL);
-		if (ret < 0) {
+	if (options_used[OPTION_E]) {
+		struct nvparam_entry blob[nvdev.flash.mtd.erasesize / sizeof(struct nvparam_entry)];
+		ulong nvparam_base = (offset / nvdev.flash.mtd.erasesize) * nvdev.flash.mtd.erasesize;
+		uint entry_no = (offset - nvparam_base) / sizeof(struct nvparam_entry);
+
+		if (nvparam_read_block(&nvdev, nvparam_base, (void *) &blob) < 0) {
+			log_printf(LOG_ERROR, "Failed to read NVPARAM\n");
 			ret = 1;
 			goto out;
 		}
 
-		ret = write(dev_fd, (void *) blob, sizeof(blob));
-		if (ret < 0) {
+		nvparam_entry_clear(&blob[entry_no]);
+
+		if (nvparam_commit_block(&nvdev, nvparam_base, (void *) blob) < 0) {
+			log_printf(LOG_ERROR, "Failed to write NVPARAM\n");
 			ret = 1;
 			goto out;
 		}
 	}
 
 	if(options_used[OPTION_L]) {
-		struct nvparam_entry blob[mtd.erasesize / sizeof(struct nvparam_entry)];
-		ulong nvparam_base = (offset / mtd.erasesize) * mtd.erasesize;
-		int tmp_crc16, cal_crc16 = 0, found_records = 0;
-		uint index, max_items = mtd.erasesize / sizeof(struct nvparam_entry);
+		struct nvparam_entry blob[nvdev.flash.mtd.erasesize / sizeof(struct nvparam_entry)];
+		ulong nvparam_base = (offset / nvdev.flash.mtd.erasesize) * nvdev.flash.mtd.erasesize;
+		int found_records = 0;
+		uint index, max_items = nvdev.flash.mtd.erasesize / sizeof(struct nvparam_entry);
 
-		if (nvparam_get(dev_fd, nvparam_base, (void *) &blob) < 0) {
+		if (nvparam_read_block(&nvdev, nvparam_base, (void *) &blob) < 0) {
 			log_printf(LOG_ERROR, "Failed to read NVPARAM\n");
 			ret = 1;
 			goto out;
@@ -889,11 +995,7 @@ int main(int argc, char *argv[])
 		/* List out all valid NVPARAM (CRC field is identical with calculated CRC) */
 		for(index = 0; index < max_items; index++)
 		{
-			tmp_crc16 = blob[index].crc16;
-			blob[index].crc16 = 0;
-			cal_crc16 = crc16((uint8_t *) &blob[index],
-					sizeof(struct nvparam_entry));
-			if(tmp_crc16 == cal_crc16)
+			if (nvparam_entry_crc_ok(&blob[index]))
 			{
 				log_printf(LOG_NORMAL, "NVPARAM at 0x%x: 0x%08x (ACL_RD:0x%x - ACL_WR:0x%x)\n",
 					nvparam_base + (index * sizeof(struct nvparam_entry)), blob[index].param1,
@@ -906,12 +1008,12 @@ int main(int argc, char *argv[])
 	}
 
 	if (options_used[OPTION_R]) {
-		struct nvparam_entry blob[mtd.erasesize / sizeof(struct nvparam_entry)];
-		ulong nvparam_base = (offset / mtd.erasesize) * mtd.erasesize;
+		struct nvparam_entry blob[nvdev.flash.mtd.erasesize / sizeof(struct nvparam_entry)];
+		ulong nvparam_base = (offset / nvdev.flash.mtd.erasesize) * nvdev.flash.mtd.erasesize;
 		uint entry_no = (offset - nvparam_base) / sizeof(struct nvparam_entry);
 		int tmp_crc16, cal_crc16 = 0;
 
-		if (nvparam_get(dev_fd, nvparam_base, (void *) &blob) < 0) {
+		if (nvparam_read_block(&nvdev, nvparam_base, (void *) &blob) < 0) {
 			log_printf(LOG_ERROR, "Failed to read NVPARAM\n");
 			ret = 1;
 			goto out;
@@ -932,7 +1034,8 @@ int main(int argc, char *argv[])
 		 * entry with crc16 = 0
 		 */
 		blob[entry_no].crc16 = 0;
-		cal_crc16 = crc16((uint8_t *) &blob[entry_no], sizeof(struct nvparam_entry));
+		cal_crc16 = nvparam_crc16((uint8_t *) &blob[entry_no],
+				sizeof(struct nvparam_entry));
 		if (tmp_crc16 != cal_crc16)
 			log_printf(LOG_NORMAL, " (Mismatch! Calculated CRC16: %x)\n", cal_crc16);
 		else
@@ -940,9 +1043,17 @@ int main(int argc, char *argv[])
 	}
 
 out:
-	close(dev_fd);
+	if (nvdev.flash.fd >= 0) {
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		flash_progress_json_result(&progress, nvdev.flash.path,
+			ret ? "failed" : "ok",
+			(uint64_t) (end.tv_sec - start.tv_sec) * 1000000 +
+			(end.tv_nsec - start.tv_nsec) / 1000);
+	}
+	nvparam_close(&nvdev);
 	close(fil_fd);
 exit_free:
+	free(named_ops);
 	if (filepath) {
 		free(filepath);
 		filepath = NULL;